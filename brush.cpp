@@ -0,0 +1,133 @@
+//
+// Paint brushes: precomputed falloff kernels and the loops that stamp them
+// into grid fields.
+//
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <utility>
+#include "brush.h"
+
+
+static brushKernel* buildBrushKernel(int size, brushFalloff falloff)
+{
+  brushKernel* kernel = new brushKernel;
+  kernel->width = (size - 1) / 2;
+  kernel->side = 2 * kernel->width + 1;
+  kernel->stride = (kernel->side + 15) & ~15;
+
+  void* block = 0;
+  if (posix_memalign(&block, 64, sizeof(float) * kernel->stride * kernel->side) != 0)
+    abort();
+  kernel->weights = (float*) block;
+
+  const int w = kernel->width;
+  for (int j = -w; j <= w; ++j)
+  {
+    float *row = kernel->weights + (j + w) * kernel->stride;
+    const float jfactor = (float(w) - (float) fabs(j)) / float(w);
+    for (int i = -w; i <= w; ++i)
+    {
+      const float ifactor = (float(w) - (float) fabs(i)) / float(w);
+      const float radius = (float) ((jfactor * jfactor + ifactor * ifactor) / 2.0);
+      if (falloff == BRUSH_FALLOFF_SOURCE)
+        row[i + w] = powf(radius, 0.5);
+      else
+        row[i + w] = (float) (1.0 - pow(radius, 1.0/4.0));
+    }
+    for (int i = kernel->side; i < kernel->stride; ++i) { row[i] = 0.0f; }
+  }
+  return kernel;
+}
+
+
+const brushKernel& getBrushKernel(int size, brushFalloff falloff)
+{
+  // any thread may paint (cfd_sweep runs scenarios side by side), so the
+  // cache is locked. kernels are never freed or moved, the returned
+  // reference stays valid without the lock
+  static std::map<std::pair<int, int>, brushKernel*> cache;
+  static std::mutex cache_mutex;
+
+  if (size < 3) { size = 3; }
+  const std::pair<int, int> key(size, (int) falloff);
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  std::map<std::pair<int, int>, brushKernel*>::iterator entry = cache.find(key);
+  if (entry == cache.end())
+    entry = cache.insert(std::make_pair(key, buildBrushKernel(size, falloff))).first;
+  return *entry->second;
+}
+
+
+// Clips the kernel footprint against the field. On return [x0, x1) and
+// [y0, y1) are the covered cells and (kx, ky) the kernel cell over (x0, y0).
+static bool clipStamp(int nx, int ny, int cx, int cy, const brushKernel& kernel,
+                      int& x0, int& x1, int& y0, int& y1, int& kx, int& ky)
+{
+  x0 = cx - kernel.width;
+  y0 = cy - kernel.width;
+  x1 = x0 + kernel.side;
+  y1 = y0 + kernel.side;
+  kx = 0;
+  ky = 0;
+  if (x0 < 0) { kx = -x0; x0 = 0; }
+  if (y0 < 0) { ky = -y0; y0 = 0; }
+  if (x1 > nx) { x1 = nx; }
+  if (y1 > ny) { y1 = ny; }
+  return x0 < x1 && y0 < y1;
+}
+
+
+void stampMultiply(float* field, int nx, int ny, int cx, int cy, const brushKernel& kernel)
+{
+  int x0, x1, y0, y1, kx, ky;
+  if (!clipStamp(nx, ny, cx, cy, kernel, x0, x1, y0, y1, kx, ky)) { return; }
+
+  const int n = x1 - x0;
+  for (int j = y0; j < y1; ++j)
+  {
+    float* __restrict dst = field + x0 + (long) nx * j;
+    const float* __restrict w = kernel.weights + kx + (long) kernel.stride * (ky + j - y0);
+#pragma omp simd
+    for (int i = 0; i < n; ++i) { dst[i] *= w[i]; }
+  }
+}
+
+
+void stampAdd(float* field, int nx, int ny, int cx, int cy, const brushKernel& kernel, float gain)
+{
+  int x0, x1, y0, y1, kx, ky;
+  if (!clipStamp(nx, ny, cx, cy, kernel, x0, x1, y0, y1, kx, ky)) { return; }
+
+  const int n = x1 - x0;
+  for (int j = y0; j < y1; ++j)
+  {
+    float* __restrict dst = field + x0 + (long) nx * j;
+    const float* __restrict w = kernel.weights + kx + (long) kernel.stride * (ky + j - y0);
+#pragma omp simd
+    for (int i = 0; i < n; ++i) { dst[i] += w[i] * gain; }
+  }
+}
+
+
+void stampAddRGB(float* field, int nx, int ny, int cx, int cy, const brushKernel& kernel, float gain)
+{
+  int x0, x1, y0, y1, kx, ky;
+  if (!clipStamp(nx, ny, cx, cy, kernel, x0, x1, y0, y1, kx, ky)) { return; }
+
+  const int n = x1 - x0;
+  for (int j = y0; j < y1; ++j)
+  {
+    float* __restrict dst = field + 3 * (x0 + (long) nx * j);
+    const float* __restrict w = kernel.weights + kx + (long) kernel.stride * (ky + j - y0);
+#pragma omp simd
+    for (int i = 0; i < n; ++i)
+    {
+      const float v = w[i] * gain;
+      dst[3*i]     += v;
+      dst[3*i + 1] += v;
+      dst[3*i + 2] += v;
+    }
+  }
+}
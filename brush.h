@@ -0,0 +1,32 @@
+//
+// Paint brushes: precomputed falloff kernels and the loops that stamp them
+// into grid fields.
+//
+
+#ifndef BRUSH_H
+#define BRUSH_H
+
+enum brushFalloff { BRUSH_FALLOFF_SOURCE, BRUSH_FALLOFF_OBSTRUCTION };
+
+// A (2*width+1)^2 kernel stored row-major in one 64 byte aligned block.
+// Each row starts on an aligned boundary, stride floats apart.
+struct brushKernel
+{
+  int   width;  // cells from the center to the edge
+  int   side;   // 2*width+1
+  int   stride; // floats between rows
+  float *weights;
+};
+
+// Kernels are built once per size and falloff and kept for the lifetime of
+// the program; safe to call from any thread. size is clamped to at least 3.
+const brushKernel& getBrushKernel(int size, brushFalloff falloff);
+
+// Stamps a kernel centered on cell (cx, cy) of an nx*ny row-major field.
+// Parts of the kernel that fall outside the field are clipped, with the
+// kernel still aligned to its center.
+void stampMultiply(float* field, int nx, int ny, int cx, int cy, const brushKernel& kernel);
+void stampAdd(float* field, int nx, int ny, int cx, int cy, const brushKernel& kernel, float gain);
+void stampAddRGB(float* field, int nx, int ny, int cx, int cy, const brushKernel& kernel, float gain);
+
+#endif //BRUSH_H
@@ -2,12 +2,28 @@
 // Created by awbrenn on 1/20/16.
 //
 #include <cmath>
+#include <cstring>
 #include "cfd.h"
+#include "cfdKernels.h"
 #include "cfdUtility.h"
+#include "displayConvert.h"
+#include "perfCounters.h"
+#include "phaseTimer.h"
 #include "iostream"
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
 
-cfd::cfd(const int nx, const int ny, const float dx, const float Dt, int Nloops, int Oploops)
+
+cfd::cfd(const int nx, const int ny, const float dx, const float Dt, int Nloops, int Oploops) :
+  cfd(nx, ny, dx, Dt, Nloops, Oploops, cfdBuffers())
+{
+}
+
+
+cfd::cfd(const int nx, const int ny, const float dx, const float Dt, int Nloops, int Oploops,
+         const cfdBuffers& buffers, unsigned fields, unsigned transported)
 {
   Nx = nx;
   Ny = ny;
@@ -17,175 +33,555 @@ cfd::cfd(const int nx, const int ny, const float dx, const float Dt, int Nloops,
   oploops = Oploops;
   gravityX = 0.0f;
   gravityY = 0.0f;
-  density1 = new float[Nx*Ny]();
-  density2 = new float[Nx*Ny]();
-  velocity1 = new float[Nx*Ny*2]();
-  velocity2 = new float[Nx*Ny*2]();
-  color1 = new float[Nx*Ny*3]();
-  color2 = new float[Nx*Ny*3]();
-  divergence = new float[Nx*Ny]();
-  pressure = new float[Nx*Ny]();
-  obstruction = new float[Nx*Ny];
-  Initialize(obstruction, Nx*Ny, 1.0);
+  nOwnedFields = 0;
+  tileShift = 5;
+  tilesX = (Nx + (1 << tileShift) - 1) >> tileShift;
+  tilesY = (Ny + (1 << tileShift) - 1) >> tileShift;
+  fieldSet = (fields & FIELD_ALL) | FIELD_VELOCITY;
+  transportedSet = transported & fieldSet;
+  density1 = fieldSet & FIELD_DENSITY ? fieldBuffer(buffers.density[0], 1, 0.0) : 0;
+  density2 = transportedSet & FIELD_DENSITY ? fieldBuffer(buffers.density[1], 1, 0.0) : 0;
+  velocity1 = fieldBuffer(buffers.velocity[0], 2, 0.0);
+  velocity2 = transportedSet & FIELD_VELOCITY ? fieldBuffer(buffers.velocity[1], 2, 0.0) : 0;
+  color1 = fieldSet & FIELD_COLOR ? fieldBuffer(buffers.color[0], 3, 0.0) : 0;
+  color2 = transportedSet & FIELD_COLOR ? fieldBuffer(buffers.color[1], 3, 0.0) : 0;
+  divergence = fieldBuffer(buffers.divergence, 1, 0.0);
+  pressure = fieldBuffer(buffers.pressure, 1, 0.0);
+  obstruction = fieldBuffer(buffers.obstruction, 1, 1.0);
   densitySourceField = 0;
   colorSourceField = 0;
   obstructionSourceField = 0;
   divergenceSourceField = 0;
+  dirtyTiles = new unsigned char[tilesX*tilesY];
+  memset(dirtyTiles, 1, (size_t) tilesX*tilesY);
+  displayMap = 0;
+  displayScale = 1.0f;
+  displayLUT = 0;
+  kernels = &cfdKernels();
+  frozenFlow = false;
+  flowChanged = false;
+  stencilValid = false;
+  deferredColor = false;
+  colorMapPending = false;
+  frameResolved = false;
+  colorMap1 = 0;
+  colorMap2 = 0;
+  skipSolids = false;
+  updateSolidCells();
 }
 
 
 cfd::~cfd()
 {
-  delete density1;
-  delete density2;
-  delete velocity1;
-  delete velocity2;
-  delete color1;
-  delete color2;
-  delete divergence;
-  delete pressure;
+  for (int k = 0; k < nOwnedFields; ++k)
+    delete [] ownedFields[k];
+  delete [] dirtyTiles;
 }
 
 
-const float cfd::getDensity(int i, int j)
+float* cfd::fieldBuffer(float* external, int components, float value)
 {
-  if (i < Nx && i >=0 && j < Ny && j >= 0)
-    return density1[dIndex(i,j)];
-  else
-    return 0.0;
+  if (external != 0)
+    return external;
+
+  // new leaves the pages untouched, so each lands on the NUMA node of the
+  // thread that first writes it: the one that owns those rows in the passes
+  float* field = new float[(size_t) Nx*Ny*components];
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+    int j0, j1;
+    threadRows(&j0, &j1);
+    for (int k = Nx*j0*components; k < Nx*j1*components; ++k) { field[k] = value; }
+  }
+  ownedFields[nOwnedFields++] = field;
+  return field;
 }
 
 
-const float cfd::getVelocity(int i, int j, int c)
+void cfd::threadRows(int* j0, int* j1) const
 {
-  if (i < Nx && i >=0 && j < Ny && j >= 0)
-    return velocity1[vIndex(i,j,c)];
-  else
-    return 0.0;
+#ifdef _OPENMP
+  rowPartition(Ny, 1 << tileShift, omp_get_thread_num(), omp_get_num_threads(), j0, j1);
+#else
+  rowPartition(Ny, 1 << tileShift, 0, 1, j0, j1);
+#endif
 }
 
 
-const float cfd::getColor(int i, int j, int c)
+const char* cfd::getKernelVariant() const
 {
-  if (i < Nx && i >=0 && j < Ny && j >= 0)
-    return color1[cIndex(i,j,c)];
-  else
-    return 0.0;
+  return kernels->name;
 }
 
 
-const float cfd::getPressure(int i, int j)
+int cfd::setKernelVariant(const char* name)
 {
-  if (i < Nx && i >=0 && j < Ny && j >= 0)
-    return pressure[pIndex(i,j)];
-  else
-    return 0.0;
+  const cfdKernelTable* table = cfdKernelVariant(name);
+  if (table == 0)
+    return -1;
+  kernels = table;
+  return 0;
 }
 
 
-const float cfd::getDivergence(int i, int j)
+int cfd::setTileSize(int size)
 {
-  if (i < Nx && i >=0 && j < Ny && j >= 0)
-    return divergence[dIndex(i,j)];
-  else
-    return 0.0;
+  int shift = 3;
+  while ((1 << shift) < size && shift < 8) { ++shift; }
+  if ((1 << shift) != size)
+    return -1;
+
+  tileShift = shift;
+  tilesX = (Nx + (1 << tileShift) - 1) >> tileShift;
+  tilesY = (Ny + (1 << tileShift) - 1) >> tileShift;
+  delete [] dirtyTiles;
+  dirtyTiles = new unsigned char[tilesX*tilesY];
+  memset(dirtyTiles, 1, (size_t) tilesX*tilesY);
+
+  // the thread bands moved, move the fields with them
+  density1 = rehomeField(density1, 1);
+  density2 = rehomeField(density2, 1);
+  velocity1 = rehomeField(velocity1, 2);
+  velocity2 = rehomeField(velocity2, 2);
+  color1 = rehomeField(color1, 3);
+  color2 = rehomeField(color2, 3);
+  divergence = rehomeField(divergence, 1);
+  pressure = rehomeField(pressure, 1);
+  obstruction = rehomeField(obstruction, 1);
+  colorMap1 = rehomeField(colorMap1, 2);
+  colorMap2 = rehomeField(colorMap2, 2);
+  return 0;
 }
 
 
-const float cfd::InterpolateDensity(int i, int j, float w1, float w2, float w3, float w4)
+int cfd::setDeferredColor(bool deferred)
 {
-  return getDensity(i    , j)     * w1 * obstruction[oIndex(i,j)] +
-         getDensity(i + 1, j)     * w2 * obstruction[oIndex(i,j)] +
-         getDensity(i    , j + 1) * w3 * obstruction[oIndex(i,j)] +
-         getDensity(i + 1, j + 1) * w4 * obstruction[oIndex(i,j)];
+  if (!deferred)
+  {
+    if (deferredColor)
+      resampleColor();
+    deferredColor = false;
+    return 0;
+  }
+
+  if (color2 == 0)
+    return -1;
+  if (colorMap1 == 0)
+  {
+    colorMap1 = fieldBuffer(0, 2, 0.0);
+    colorMap2 = fieldBuffer(0, 2, 0.0);
+    resetColorMap();
+  }
+  deferredColor = true;
+  return 0;
+}
+
+
+void cfd::resolveColor()
+{
+  if (!deferredColor)
+    return; // every step already moved color
+
+  CFD_TRACE_SCOPE("resolveColor");
+  CFD_PERF_SCOPE("resolveColor");
+  if (colorMapPending)
+  {
+    resampleColor();
+  }
+  else if (displayMap != 0)
+  {
+    // nothing to resample, but the display still wants this frame
+#ifdef __linux__
+#pragma omp parallel
+#endif
+    {
+      int j0, j1;
+      threadRows(&j0, &j1);
+      for (int j=j0; j<j1; ++j) { convertDisplayRow(color1, j); }
+    }
+  }
+  frameResolved = true;
 }
 
 
-const float cfd::InterpolateVelocity(int i, int j, int c, float w1, float w2, float w3, float w4)
+void cfd::resetColorMap()
 {
-  return getVelocity(i    , j,     c) * w1 * obstruction[oIndex(i,j)] +
-         getVelocity(i + 1, j,     c) * w2 * obstruction[oIndex(i,j)] +
-         getVelocity(i,     j + 1, c) * w3 * obstruction[oIndex(i,j)] +
-         getVelocity(i + 1, j + 1, c) * w4 * obstruction[oIndex(i,j)];
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+    int j0, j1;
+    threadRows(&j0, &j1);
+    for (int j=j0; j<j1; ++j)
+    {
+      for (int i=0; i<Nx; ++i)
+      {
+        colorMap1[vIndex(i,j,0)] = (float) i;
+        colorMap1[vIndex(i,j,1)] = (float) j;
+      }
+    }
+  }
+  colorMapPending = false;
 }
 
 
-const float cfd::InterpolateColor(int i, int j, int c, float w1, float w2, float w3, float w4)
+void cfd::resampleColor()
 {
-  return getColor(i    , j,     c) * w1 +
-         getColor(i + 1, j,     c) * w2 +
-         getColor(i,     j + 1, c) * w3 +
-         getColor(i + 1, j + 1, c) * w4;
+  if (!colorMapPending)
+    return;
+
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+    int j0, j1;
+    threadRows(&j0, &j1);
+    for (int j=j0; j<j1; ++j)
+    {
+      kernels->resampleColorRow(color1, colorMap1, color2, Nx, Ny, j);
+      markChangedColor(j);
+      if (displayMap != 0)
+        convertDisplayRow(color2, j);
+    }
+  }
+  swapFloatPointers(&color1, &color2);
+  resetColorMap();
 }
 
 
-void cfd::bilinearlyInterpolate(const int ii, const int jj, const float x, const float y)
+float* cfd::rehomeField(float* field, int components)
 {
-  // get index of sample
-  const int i = (int) (x/Dx);
-  const int j = (int) (y/Dx);
-
-  // get weights of samples
-  const float ax = std::abs(x/Dx - i);
-  const float ay = std::abs(y/Dx - j);
-  const float w1 = (1-ax) * (1-ay);
-  const float w2 = ax * (1-ay);
-  const float w3 = (1-ax) * ay;
-  const float w4 = ax * ay;
-
-  density2[dIndex(ii, jj)] = InterpolateDensity(i, j, w1, w2, w3, w4);
-
-  velocity2[vIndex(ii, jj, 0)] = InterpolateVelocity(i, j, 0, w1, w2, w3, w4);
-  velocity2[vIndex(ii, jj, 1)] = InterpolateVelocity(i, j, 1, w1, w2, w3, w4);
-
-  color2[cIndex(ii, jj, 0)] = InterpolateColor(i, j, 0, w1, w2, w3, w4);
-  color2[cIndex(ii, jj, 1)] = InterpolateColor(i, j, 1, w1, w2, w3, w4);
-  color2[cIndex(ii, jj, 2)] = InterpolateColor(i, j, 2, w1, w2, w3, w4);
+  for (int k = 0; k < nOwnedFields; ++k)
+  {
+    if (ownedFields[k] != field)
+      continue;
+
+    float* moved = new float[(size_t) Nx*Ny*components];
+#ifdef __linux__
+#pragma omp parallel
+#endif
+    {
+      int j0, j1;
+      threadRows(&j0, &j1);
+      for (int c = Nx*j0*components; c < Nx*j1*components; ++c) { moved[c] = field[c]; }
+    }
+    delete [] field;
+    ownedFields[k] = moved;
+    return moved;
+  }
+  return field; // the host's buffer, left where it is
+}
+
+
+void cfd::updateSolidCells()
+{
+  CFD_TRACE_SCOPE("updateSolidCells");
+  fluidRowRun.assign(Ny+1, 0);
+  fluidRun.clear();
+  fluidCells = 0;
+  for (int j=0; j<Ny; ++j)
+  {
+    fluidRowRun[j] = (int) fluidRun.size() / 2;
+    int i = 0;
+    while (i < Nx)
+    {
+      if (obstruction[oIndex(i,j)] == 0.0f)
+      {
+        ++i;
+        continue;
+      }
+      const int start = i;
+      while (i < Nx && obstruction[oIndex(i,j)] != 0.0f) { ++i; }
+      fluidRun.push_back(start);
+      fluidRun.push_back(i);
+      fluidCells += i - start;
+    }
+  }
+  fluidRowRun[Ny] = (int) fluidRun.size() / 2;
+
+  if (wholeRowRun.empty())
+  {
+    for (int j=0; j<=Ny; ++j) { wholeRowRun.push_back(j); }
+    for (int j=0; j<Ny; ++j) { wholeRun.push_back(0); wholeRun.push_back(Nx); }
+  }
+
+  // the pressure passes leave solids alone from here on, clear what they
+  // left there
+  for (int k = 0; skipSolids && k < Nx*Ny; ++k)
+  {
+    if (obstruction[k] != 0.0f)
+      continue;
+    divergence[k] = 0.0f;
+    pressure[k] = 0.0f;
+    velocity1[2*k] = 0.0f;
+    velocity1[2*k+1] = 0.0f;
+  }
+}
+
+
+cfdFluidRuns cfd::solverRuns() const
+{
+  const bool fluid = skipSolids && fluidCells < Nx*Ny;
+  const std::vector<int>& rowRun = fluid ? fluidRowRun : wholeRowRun;
+  const std::vector<int>& run = fluid ? fluidRun : wholeRun;
+  const cfdFluidRuns runs = { &rowRun[0], run.empty() ? 0 : &run[0] };
+  return runs;
+}
+
+
+void cfd::advectSolidCells(float* colorOut, int j, int i0, int i1)
+{
+  // what advectRow gives a cell with obstruction 0: it traces back to
+  // itself and keeps its color, density and velocity scaled to 0
+  for (int i=i0; i<i1; ++i)
+  {
+    if (density2 != 0)
+      density2[dIndex(i,j)] = 0.0f;
+    if (velocity2 != 0)
+    {
+      velocity2[vIndex(i,j,0)] = 0.0f;
+      velocity2[vIndex(i,j,1)] = 0.0f;
+    }
+  }
+  if (colorOut != 0)
+    memcpy(colorOut + cIndex(i0,j,0), color1 + cIndex(i0,j,0), sizeof(float) * 3 * (i1 - i0));
+  if (deferredColor)
+    memcpy(colorMap2 + vIndex(i0,j,0), colorMap1 + vIndex(i0,j,0), sizeof(float) * 2 * (i1 - i0));
+}
+
+
+void cfd::convertDisplayRow(const float* color, int j)
+{
+  floatToDisplayBytes(color + cIndex(0,j,0), displayMap + cIndex(0,j,0), Nx*3, displayScale, displayLUT);
 }
 
 
 void cfd::advect()
 {
-  float x, y;
+  CFD_TRACE_SCOPE("advect");
+  CFD_PERF_SCOPE("advect");
+
+  // deferred color gathers changes from one resolved frame to the next
+  if (!deferredColor || frameResolved)
+    memset(dirtyTiles, 0, (size_t) tilesX*tilesY);
+  frameResolved = false;
+
+  // with no sources pending this is the last pass that writes color. when
+  // color is deferred resolveColor() writes the display instead
+  const bool fuse_display = displayMap != 0 && color1 != 0 && colorSourceField == 0 &&
+                            obstructionSourceField == 0 && !deferredColor;
+
+  if (frozenFlow && !flowChanged)
+  {
+    if (deferredColor)
+      resampleColor(); // the stencil moves color itself
+    if (!stencilValid)
+      buildFrozenStencil();
+    advectFrozenColor(fuse_display);
+    return;
+  }
+
+  float* const colorOut = deferredColor ? 0 : color2;
+  const cfdAdvectFields fields = { Nx, Ny, Dx, dt, density1, velocity1, color1, obstruction, colorMap1,
+                                   density2, velocity2, colorOut, deferredColor ? colorMap2 : 0 };
 
   // advect each grid point
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+    int j0, j1;
+    threadRows(&j0, &j1);
+    for (int j=j0; j<j1; ++j)
+    {
+      int done = 0;
+      for (int r = fluidRowRun[j]; r < fluidRowRun[j+1]; ++r)
+      {
+        advectSolidCells(colorOut, j, done, fluidRun[2*r]);
+        kernels->advectRow(fields, j, fluidRun[2*r], fluidRun[2*r+1]);
+        done = fluidRun[2*r+1];
+      }
+      advectSolidCells(colorOut, j, done, Nx);
+      if (colorOut != 0)
+        markChangedColor(j);
+      if (fuse_display)
+        convertDisplayRow(colorOut != 0 ? colorOut : color1, j);
+    }
+  }
+
+  // fields that are not transported have no second buffer and stay put
+  if (density2 != 0)
+    swapFloatPointers(&density1, &density2);
+  if (velocity2 != 0)
+    swapFloatPointers(&velocity1, &velocity2);
+  if (colorOut != 0)
+    swapFloatPointers(&color1, &color2);
+  if (deferredColor)
+  {
+    swapFloatPointers(&colorMap1, &colorMap2);
+    colorMapPending = true;
+  }
+}
+
+
+void cfd::markChangedColor(int j)
+{
+  for (int i=0; i<Nx; ++i)
+  {
+    if (color2[cIndex(i,j,0)] != color1[cIndex(i,j,0)] ||
+        color2[cIndex(i,j,1)] != color1[cIndex(i,j,1)] ||
+        color2[cIndex(i,j,2)] != color1[cIndex(i,j,2)])
+      markDirty(i, j);
+  }
+}
+
+
+void cfd::buildFrozenStencil()
+{
+  CFD_TRACE_SCOPE("buildFrozenStencil");
+
+  stencilBase.resize((size_t) Nx*Ny);
+  stencilWeight.resize((size_t) Nx*Ny*4);
+  stencilEdges.clear();
+
+  // the backtrace of advectRow, kept instead of applied
   for (int j=0; j<Ny; ++j)
   {
-    for (int i=0; i<Nx; ++i)
+    for (int ii=0; ii<Nx; ++ii)
+    {
+      const float o = obstruction[oIndex(ii,j)];
+      const float x = ii*Dx - velocity1[vIndex(ii,j,0)]*dt * o;
+      const float y = j*Dx - velocity1[vIndex(ii,j,1)]*dt * o;
+      const int i = (int) (x/Dx);
+      const int jj = (int) (y/Dx);
+      const float ax = std::abs(x/Dx - i);
+      const float ay = std::abs(y/Dx - jj);
+      const float w[4] = { (1-ax) * (1-ay), ax * (1-ay), (1-ax) * ay, ax * ay };
+
+      const int k = dIndex(ii,j);
+      if (i >= 0 && i+1 < Nx && jj >= 0 && jj+1 < Ny)
+      {
+        stencilBase[k] = dIndex(i,jj);
+        for (int n = 0; n < 4; ++n) { stencilWeight[4*k+n] = w[n]; }
+        continue;
+      }
+
+      // samples off the grid count as 0, as in advect
+      stencilEdge edge;
+      for (int n = 0; n < 4; ++n)
+      {
+        const int si = i + (n & 1), sj = jj + (n >> 1);
+        const bool inside = si >= 0 && si < Nx && sj >= 0 && sj < Ny;
+        edge.index[n] = inside ? dIndex(si,sj) : 0;
+        edge.weight[n] = inside ? w[n] : 0.0f;
+      }
+      stencilBase[k] = -1 - (int) stencilEdges.size();
+      stencilEdges.push_back(edge);
+    }
+  }
+  stencilValid = true;
+}
+
+
+void cfd::advectFrozenColor(bool fuse_display)
+{
+  if (color2 == 0)
+  {
+    // nothing moves, the display still wants this step's rows
+    for (int j=0; fuse_display && j<Ny; ++j) { convertDisplayRow(color1, j); }
+    return;
+  }
+
+  const int* base = &stencilBase[0];
+  const float* weight = &stencilWeight[0];
+  const stencilEdge* edges = stencilEdges.empty() ? 0 : &stencilEdges[0];
+
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+    int j0, j1;
+    threadRows(&j0, &j1);
+    for (int j=j0; j<j1; ++j)
     {
-      x = i*Dx - velocity1[vIndex(i,j,0)]*dt * obstruction[oIndex(i,j)];
-      y = j*Dx - velocity1[vIndex(i,j,1)]*dt * obstruction[oIndex(i,j)];
-      bilinearlyInterpolate(i, j, x, y);
+      for (int k = dIndex(0,j); k < dIndex(0,j+1); ++k)
+      {
+        const int b = base[k];
+        if (b >= 0)
+        {
+          const float* w = weight + 4*k;
+          const float *c00 = color1 + 3*b, *c01 = color1 + 3*(b+Nx);
+          for (int c = 0; c < 3; ++c)
+            color2[3*k+c] = c00[c] * w[0] + c00[3+c] * w[1] + c01[c] * w[2] + c01[3+c] * w[3];
+        }
+        else
+        {
+          const stencilEdge& e = edges[-1-b];
+          for (int c = 0; c < 3; ++c)
+          {
+            color2[3*k+c] = color1[3*e.index[0]+c] * e.weight[0] + color1[3*e.index[1]+c] * e.weight[1] +
+                            color1[3*e.index[2]+c] * e.weight[2] + color1[3*e.index[3]+c] * e.weight[3];
+          }
+        }
+      }
+      markChangedColor(j);
+      if (fuse_display)
+        convertDisplayRow(color2, j);
     }
   }
 
-  swapFloatPointers(&density1, &density2);
-  swapFloatPointers(&velocity1, &velocity2);
   swapFloatPointers(&color1, &color2);
 }
 
 
 void cfd::addSourceColor()
 {
+  CFD_TRACE_SCOPE("addSourceColor");
+  CFD_PERF_SCOPE("addSourceColor");
+  if (colorSourceField != 0 && color1 == 0)
+  {
+    // no color field, use the source up anyway
+    Initialize(colorSourceField, Nx*Ny*3, 0.0);
+    colorSourceField = 0;
+  }
   if (colorSourceField != 0)
   {
-    for (int j=0; j<Ny; ++j)
+    if (deferredColor)
+      resampleColor(); // the source lands on the color as it is now
+    const bool fuse_display = displayMap != 0 && obstructionSourceField == 0;
+
+#ifdef __linux__
+#pragma omp parallel
+#endif
     {
-      for (int i=0; i<Nx; ++i)
+      int j0, j1;
+      threadRows(&j0, &j1);
+      for (int j=j0; j<j1; ++j)
       {
-        color1[cIndex(i,j,0)] += colorSourceField[cIndex(i,j,0)] * obstruction[oIndex(i,j)];
-        color1[cIndex(i,j,1)] += colorSourceField[cIndex(i,j,1)] * obstruction[oIndex(i,j)];;
-        color1[cIndex(i,j,2)] += colorSourceField[cIndex(i,j,2)] * obstruction[oIndex(i,j)];;
-
-        // clamp color values to 1.0f
-        if (color1[cIndex(i,j,0)] > 1.0f)
-          color1[cIndex(i,j,0)] = 1.0f;
-
-        if (color1[cIndex(i,j,1)] > 1.0f)
-          color1[cIndex(i,j,1)] = 1.0f;
-
-        if (color1[cIndex(i,j,2)] > 1.0f)
-          color1[cIndex(i,j,2)] = 1.0f;
+        for (int i=0; i<Nx; ++i)
+        {
+          color1[cIndex(i,j,0)] += colorSourceField[cIndex(i,j,0)] * obstruction[oIndex(i,j)];
+          color1[cIndex(i,j,1)] += colorSourceField[cIndex(i,j,1)] * obstruction[oIndex(i,j)];;
+          color1[cIndex(i,j,2)] += colorSourceField[cIndex(i,j,2)] * obstruction[oIndex(i,j)];;
+
+          if (colorSourceField[cIndex(i,j,0)] != 0.0f || colorSourceField[cIndex(i,j,1)] != 0.0f ||
+              colorSourceField[cIndex(i,j,2)] != 0.0f)
+            markDirty(i, j);
+
+          // clamp color values to 1.0f
+          if (color1[cIndex(i,j,0)] > 1.0f)
+            color1[cIndex(i,j,0)] = 1.0f;
+
+          if (color1[cIndex(i,j,1)] > 1.0f)
+            color1[cIndex(i,j,1)] = 1.0f;
+
+          if (color1[cIndex(i,j,2)] > 1.0f)
+            color1[cIndex(i,j,2)] = 1.0f;
+        }
+        if (fuse_display)
+          convertDisplayRow(color1, j);
       }
     }
     // re-initialize colorSourceField
@@ -197,13 +593,27 @@ void cfd::addSourceColor()
 
 void cfd::addSourceDensity()
 {
+  CFD_TRACE_SCOPE("addSourceDensity");
+  CFD_PERF_SCOPE("addSourceDensity");
+  if (densitySourceField != 0 && density1 == 0)
+  {
+    Initialize(densitySourceField, Nx*Ny, 0.0);
+    densitySourceField = 0;
+  }
   if (densitySourceField != 0)
   {
-    for (int j=0; j<Ny; ++j)
+#ifdef __linux__
+#pragma omp parallel
+#endif
     {
-      for (int i=0; i<Nx; ++i)
+      int j0, j1;
+      threadRows(&j0, &j1);
+      for (int j=j0; j<j1; ++j)
       {
-        density1[dIndex(i,j)] += densitySourceField[dIndex(i,j)] * obstruction[oIndex(i,j)];;
+        for (int i=0; i<Nx; ++i)
+        {
+          density1[dIndex(i,j)] += densitySourceField[dIndex(i,j)] * obstruction[oIndex(i,j)];;
+        }
       }
     }
     // re-initialize densitySourceField
@@ -215,139 +625,171 @@ void cfd::addSourceDensity()
 
 void cfd::addSourceObstruction()
 {
+  CFD_TRACE_SCOPE("addSourceObstruction");
+  CFD_PERF_SCOPE("addSourceObstruction");
   if (obstructionSourceField != 0)
   {
+    if (deferredColor)
+      resampleColor();
     float* color = getColorPointer();
 
-    for (int j=0; j<Ny; ++j)
+#ifdef __linux__
+#pragma omp parallel
+#endif
     {
-      for (int i=0; i<Nx; ++i)
+      int j0, j1;
+      threadRows(&j0, &j1);
+      for (int j=j0; j<j1; ++j)
       {
-        obstruction[oIndex(i,j)] *= obstructionSourceField[oIndex(i,j)];
-
-        // remove color where the obstruction is
-        color[cIndex(i,j,0)] *= obstructionSourceField[oIndex(i,j)];
-        color[cIndex(i,j,1)] *= obstructionSourceField[oIndex(i,j)];
-        color[cIndex(i,j,2)] *= obstructionSourceField[oIndex(i,j)];
+        for (int i=0; i<Nx; ++i)
+        {
+          obstruction[oIndex(i,j)] *= obstructionSourceField[oIndex(i,j)];
+        }
+        if (color == 0)
+          continue;
+
+        for (int i=0; i<Nx; ++i)
+        {
+          // remove color where the obstruction is
+          color[cIndex(i,j,0)] *= obstructionSourceField[oIndex(i,j)];
+          color[cIndex(i,j,1)] *= obstructionSourceField[oIndex(i,j)];
+          color[cIndex(i,j,2)] *= obstructionSourceField[oIndex(i,j)];
+
+          if (obstructionSourceField[oIndex(i,j)] != 1.0f)
+            markDirty(i, j);
+        }
+        if (displayMap != 0)
+          convertDisplayRow(color, j);
       }
     }
     // re-initialize obstructionSourceField
     Initialize(obstructionSourceField, Nx*Ny, 1.0);
     obstructionSourceField = 0;
+    updateSolidCells();
   }
 }
 
 
 void cfd::computeVelocity(float force_x, float force_y)
 {
-  for (int j=0; j<Ny; ++j)
+  CFD_TRACE_SCOPE("computeVelocity");
+  CFD_PERF_SCOPE("computeVelocity");
+  if (density1 == 0)
+    return; // the forces act on density, without it there is nothing to push
+
+#ifdef __linux__
+#pragma omp parallel
+#endif
   {
-    for (int i=0; i<Nx; ++i)
-    {
-      velocity1[vIndex(i,j,0)] += (force_x * density1[dIndex(i,j)]*dt);
-      velocity1[vIndex(i,j,1)] += (force_y * density1[dIndex(i,j)]*dt);
-    }
+    int j0, j1;
+    threadRows(&j0, &j1);
+    kernels->computeVelocity(velocity1 + vIndex(0,j0,0), density1 + dIndex(0,j0), Nx*(j1-j0), force_x, force_y, dt);
   }
 }
 
 
 void cfd::computeDivergence()
 {
-  int index;
-  for (int j = 0; j < Ny; ++j)
+  CFD_TRACE_SCOPE("computeDivergence");
+  CFD_PERF_SCOPE("computeDivergence");
+#ifdef __linux__
+#pragma omp parallel
+#endif
   {
-    for (int i = 0; i < Nx; ++i)
+    int j0, j1;
+    threadRows(&j0, &j1);
+    kernels->computeDivergence(velocity1, divergence, Nx, Ny, Dx, j0, j1, solverRuns());
+
+    if (divergenceSourceField != 0)
     {
-      index = dIndex(i,j);
-      divergence[index] = (getVelocity(i+1, j,   0) -
-                                 getVelocity(i-1, j,   0)) / (2*Dx) +
-                                (getVelocity(i,   j+1, 1) -
-                                 getVelocity(i,   j-1, 1)) / (2*Dx);
-
-      if (divergenceSourceField != 0)
-        divergence[index] += divergenceSourceField[index];
+      for (int k = Nx*j0; k < Nx*j1; ++k) { divergence[k] += divergenceSourceField[k]; }
     }
   }
-  if (divergenceSourceField != 0) {
-    // re-initialize colorSourceField
+
+  if (divergenceSourceField != 0)
+  {
+    // re-initialize divergenceSourceField
     Initialize(divergenceSourceField, Nx * Ny, 0.0);
     divergenceSourceField = 0;
   }
-
 }
 
 
-void cfd::computePressure()
+float cfd::divergenceResidual() const
 {
-  Initialize(pressure, Nx*Ny, 0.0);
-
-  for(int k = 0; k < nloops; ++k)
+  // same central differences as computeDivergence, zero outside the grid
+  double sum = 0.0;
+  for (int j = 0; j < Ny; ++j)
   {
-    for (int j = 0; j < Ny; ++j)
+    for (int i = 0; i < Nx; ++i)
     {
-      for (int i = 0; i < Nx; ++i)
-      {
-        pressure[pIndex(i,j)] = ((getPressure(i+1, j)     +
-                                   getPressure(i-1, j)    +
-                                   getPressure(i,   j+1)  +
-                                   getPressure(i,   j-1)) *
-                                   0.25f) - ((Dx*Dx/4.0f) * getDivergence(i,j));
-      }
+      const float right = i+1 < Nx ? velocity1[vIndex(i+1,j,0)] : 0.0f;
+      const float left  = i > 0    ? velocity1[vIndex(i-1,j,0)] : 0.0f;
+      const float up    = j+1 < Ny ? velocity1[vIndex(i,j+1,1)] : 0.0f;
+      const float down  = j > 0    ? velocity1[vIndex(i,j-1,1)] : 0.0f;
+      const float div = (right - left) / (2*Dx) + (up - down) / (2*Dx);
+      sum += (double) div * div;
     }
   }
+  return (float) std::sqrt(sum / ((double) Nx*Ny));
 }
 
 
-void cfd::computePressureForces(int i, int j, float* force_x, float* force_y)
+void cfd::computePressure()
 {
-  *force_x = (getPressure(i+1, j) - getPressure(i-1, j)) / (2*Dx);
-  *force_y = (getPressure(i, j+1) - getPressure(i, j-1)) / (2*Dx);
+  CFD_TRACE_SCOPE("computePressure");
+  CFD_PERF_SCOPE("computePressure");
+  Initialize(pressure, Nx*Ny, 0.0);
+  kernels->computePressure(pressure, divergence, Nx, Ny, Dx, nloops, solverRuns());
 }
 
 
 void cfd::computeVelocityBasedOnPressureForces()
 {
-  float force_x, force_y;
-
-  for (int j = 0; j < Ny; ++j)
+  CFD_TRACE_SCOPE("computeVelocityBasedOnPressureForces");
+  CFD_PERF_SCOPE("computeVelocityBasedOnPressureForces");
+#ifdef __linux__
+#pragma omp parallel
+#endif
   {
-    for (int i = 0; i < Nx; ++i)
-    {
-      computePressureForces(i, j, &force_x, &force_y);
-      velocity1[vIndex(i,j,0)] -= force_x;
-      velocity1[vIndex(i,j,1)] -= force_y;
-    }
+    int j0, j1;
+    threadRows(&j0, &j1);
+    kernels->applyPressureForces(pressure, velocity1, Nx, Ny, Dx, j0, j1, solverRuns());
   }
 }
 
 
 void cfd::computeObstructedFields()
 {
-  for (int j = 0; j < Ny; ++j)
+  CFD_TRACE_SCOPE("computeObstructedFields");
+  CFD_PERF_SCOPE("computeObstructedFields");
+#ifdef __linux__
+#pragma omp parallel
+#endif
   {
-    for (int i = 0; i < Nx; ++i)
-    {
-      velocity1[vIndex(i, j, 0)] *= obstruction[oIndex(i, j)];
-      velocity1[vIndex(i, j, 0)] *= obstruction[oIndex(i, j)];
-      density1[dIndex(i,j)] *= obstruction[oIndex(i,j)];
-
-      // set boundaries
-      if (i == 0 || i == Nx-1)
-        velocity1[vIndex(i,j,0)] = 0.0f;
-      else if (j == 0 || j == Ny - 1)
-        velocity1[vIndex(i,j,1)] = 0.0f;
-    }
+    int j0, j1;
+    threadRows(&j0, &j1);
+    kernels->applyObstruction(velocity1, density1, obstruction, Nx, Ny, j0, j1);
   }
 }
 
 
 void cfd::sources()
 {
+  CFD_TRACE_SCOPE("sources");
+  CFD_PERF_SCOPE("sources");
   // add sources
   addSourceColor();
   addSourceDensity();
   addSourceObstruction();
 
+  if (frozenFlow && !flowChanged)
+    return; // the velocity is held
+
+  // the flow moves on, a frozen stencil has to be rebuilt from it
+  flowChanged = false;
+  stencilValid = false;
+
   // compute sources
   computeVelocity(gravityX, gravityY);
 
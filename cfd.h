@@ -5,25 +5,145 @@
 #ifndef CFD_H
 #define CFD_H
 
+#include <vector>
+
+struct cfdKernelTable;
+struct cfdFluidRuns;
+
+// Field storage a host can hand to the solver instead of having it allocate
+// its own. Density, velocity and color are double buffered, so they take
+// two arrays each; which of the two holds the current field changes every
+// step, so always read through the getters. Arrays are used as they are,
+// not cleared (obstruction is 1 where the fluid is free). Any pointer left
+// 0 is allocated and owned by the solver. Sizes are Nx*Ny floats, times 2
+// for velocity and 3 for color, in the row-major layout of the index
+// functions below.
+struct cfdBuffers
+{
+  float *density[2];
+  float *velocity[2];
+  float *color[2];
+  float *divergence;
+  float *pressure;
+  float *obstruction;
+};
+
+// The passes split the grid between the OpenMP threads of the calling
+// thread in bands of whole tile rows, and the fields the solver allocates
+// are first touched with the same split, so on a NUMA machine each thread
+// mostly works on memory local to it. Construct and step a cfd with the
+// same team size and thread placement (see threadConfig.h).
 class cfd
 {
   public:
+    // Field registry: the fields a cfd keeps, and which of them advect
+    // carries along the flow. Velocity is always kept, the passes solve for
+    // it. A field left out is not allocated: its getter returns 0 and its
+    // sources are used up without effect. A field kept but not transported
+    // has no second buffer and stays where it is. Density only feeds the
+    // gravity force, so a gravity-free host loses nothing by leaving it out.
+    enum cfdField
+    {
+      FIELD_DENSITY  = 1,
+      FIELD_VELOCITY = 2,
+      FIELD_COLOR    = 4,
+      FIELD_ALL      = 7
+    };
+
     // constructors/destructors
     cfd(const int nx, const int ny, const float dx, const float dt, int Nloops, int Oploops);
+    cfd(const int nx, const int ny, const float dx, const float dt, int Nloops, int Oploops,
+        const cfdBuffers& buffers, unsigned fields = FIELD_ALL, unsigned transported = FIELD_ALL);
     ~cfd();
 
     // public methods
     void advect();
     void sources();
+    void step() { advect(); sources(); }
+
+    // root mean square of the divergence of the current velocity field,
+    // how far the last projection is from incompressible
+    float divergenceResidual() const;
 
     // getters
-    float* getColorPointer()    const { return color1; }
+    int getNx()                    const { return Nx; }
+    int getNy()                    const { return Ny; }
+    unsigned getFields()           const { return fieldSet; }
+    unsigned getTransportedFields() const { return transportedSet; }
+    float* getColorPointer()       const { return color1; }
+    float* getDensityPointer()     const { return density1; }
+    float* getVelocityPointer()    const { return velocity1; }
+    float* getPressurePointer()    const { return pressure; }
+    float* getDivergencePointer()  const { return divergence; }
+    float* getObstructionPointer() const { return obstruction; }
+
+    // Color is tracked in square tiles of getTileSize() cells. getDirtyTiles()
+    // holds one flag per tile, row-major, set if any color in the tile changed
+    // since the start of the last advect().
+    int getTileSize()                   const { return 1 << tileShift; }
+    int getTilesX()                     const { return tilesX; }
+    int getTilesY()                     const { return tilesY; }
+    const unsigned char* getDirtyTiles() const { return dirtyTiles; }
+    const char* getKernelVariant()      const;
 
     // setters
-    void setDensitySourceField(float* dsrc)     { densitySourceField = dsrc; }
+    void setDensitySourceField(float* dsrc)     { densitySourceField = dsrc; if (dsrc && density1) { flowChanged = true; } }
     void setColorSourceField(float* csrc)       { colorSourceField = csrc; }
-    void setObstructionSourceField(float* osrc) { obstructionSourceField = osrc; }
-    void setDivergenceSourceField(float* dsrc) { divergenceSourceField = dsrc; }
+    void setObstructionSourceField(float* osrc) { obstructionSourceField = osrc; if (osrc) { flowChanged = true; } }
+    void setDivergenceSourceField(float* dsrc) { divergenceSourceField = dsrc; if (dsrc) { flowChanged = true; } }
+
+    // Frozen flow: while on, a step holds velocity and density as they are
+    // and only moves color, gathering it through source indices and bilinear
+    // weights cached per cell on the first frozen step. A step with a
+    // density, divergence or obstruction source pending runs in full and
+    // the cache is rebuilt on the next one; color sources leave the flow
+    // alone. Call invalidateFrozenFlow() after writing velocity or
+    // obstruction through their pointers.
+    void setFrozenFlow(bool frozen)    { frozenFlow = frozen; stencilValid = false; }
+    bool getFrozenFlow()         const { return frozenFlow; }
+    void invalidateFrozenFlow()        { stencilValid = false; }
+
+    // Deferred color: while on, advect() does not move color but composes
+    // the step's backtrace into a map of where each cell's color comes from
+    // (2 floats per cell), and color is resampled through it in one pass
+    // when resolveColor() asks for a frame, when a color or obstruction
+    // source needs it, or when deferring is turned off. Capturing every Nth
+    // step then interpolates color once per frame rather than once per step,
+    // so it smears less. The resample treats the grid edges as advect()
+    // does, so resolving after every step gives advect()'s color. Until then
+    // getColorPointer() holds the color of the last resample, and the dirty
+    // tiles gather every change since the advect() after the last
+    // resolveColor(). Needs color transported; returns -1 and stays off
+    // otherwise.
+    int  setDeferredColor(bool deferred);
+    bool getDeferredColor()      const { return deferredColor; }
+    void resolveColor();
+
+    // Solid cells (obstruction 0) are found as runs of fluid cells per row,
+    // kept up to date by obstruction sources. advect() copies over solid
+    // cells instead of tracing them back, which gives the same result. With
+    // skipping on, the pressure passes leave solids out too: they hold
+    // pressure 0 like the outside of the grid and their velocity stays 0,
+    // which changes the flow next to them. Call updateSolidCells() after
+    // writing obstruction through its pointer.
+    void setSkipSolids(bool skip)      { skipSolids = skip; updateSolidCells(); }
+    bool getSkipSolids()         const { return skipSolids; }
+    void updateSolidCells();
+    int  getFluidCells()         const { return fluidCells; }
+
+    // When a display map is set, every row of color is converted to bytes
+    // (see floatToDisplayBytes) right after the last pass of the step that
+    // writes it, while it is still in cache. pass 0 to turn this off.
+    void setDisplayTarget(unsigned char* map, float scale, const unsigned char* lut)
+    { displayMap = map; displayScale = scale; displayLUT = lut; }
+
+    // Tuning, normally picked by cfdTuning.h. The kernel variant takes the
+    // names cfdKernelVariant() does. The tile size (a power of two from 8 to
+    // 256) sets both the dirty tiles and the bands of rows the threads split,
+    // so set it before the first step and before reading the tile getters.
+    // both return -1 and keep the current setting if the value is refused.
+    int setKernelVariant(const char* name);
+    int setTileSize(int size);
 
     // indexing
     int dIndex(int i, int j)        const { return i+Nx*j; }
@@ -31,11 +151,19 @@ class cfd
     int oIndex(int i, int j)        const { return i+Nx*j; }
     int vIndex(int i, int j, int c) const { return (i+Nx*j)*2+c; }
     int cIndex(int i, int j, int c) const { return (i+Nx*j)*3+c; }
+    int tIndex(int i, int j)        const { return (i >> tileShift) + tilesX*(j >> tileShift); }
 
   private:
+    friend class cfdBench; // times the private passes one at a time
+
+    // frees the buffers it owns on destruction, so it cannot be copied
+    cfd(const cfd&);
+    cfd& operator=(const cfd&);
+
     int     Nx, Ny;
     int     nloops; // number of loops for pressure calculation
     int     oploops; // number of orthogonal projection loops
+    unsigned fieldSet, transportedSet; // cfdField bits
     float   Dx;
     float   dt;
     float   gravityX, gravityY;
@@ -49,6 +177,44 @@ class cfd
     float   *colorSourceField;
     float   *obstructionSourceField;
     float   *divergenceSourceField;
+    float   *ownedFields[11]; // the buffers allocated here, freed on destruction
+    int     nOwnedFields;
+    int     tileShift; // log2 of the dirty tile size
+    int     tilesX, tilesY;
+    unsigned char *dirtyTiles;
+    unsigned char *displayMap;
+    float   displayScale;
+    const unsigned char *displayLUT;
+    const cfdKernelTable *kernels; // the instruction set variant in use
+
+    // frozen flow: an interior cell gathers color from the 2x2 block at
+    // stencilBase[k] with stencilWeight[4k..4k+3]. a cell with a sample off
+    // the grid has stencilBase -1-e and its samples in stencilEdges[e]
+    struct stencilEdge
+    {
+      int   index[4];
+      float weight[4];
+    };
+    bool    frozenFlow;
+    bool    flowChanged; // a source that changes velocity or obstruction is pending
+    bool    stencilValid;
+    std::vector<int>         stencilBase;
+    std::vector<float>       stencilWeight;
+    std::vector<stencilEdge> stencilEdges;
+
+    // deferred color: colorMap1 maps each cell into color1, see cfdAdvectFields
+    // in cfdKernels.h. colorMap2 is the composing buffer
+    bool    deferredColor;
+    bool    colorMapPending; // colorMap1 is not the identity
+    bool    frameResolved;   // resolveColor() ran since the last advect()
+    float   *colorMap1, *colorMap2;
+
+    // fluid cells as runs of columns per row, see cfdFluidRuns in
+    // cfdKernels.h
+    bool    skipSolids;
+    int     fluidCells;
+    std::vector<int> fluidRowRun, fluidRun;
+    std::vector<int> wholeRowRun, wholeRun; // one run per row, for the passes without skipSolids
 
     // private methods
     void addSourceColor();
@@ -56,19 +222,21 @@ class cfd
     void addSourceObstruction();
     void computeDivergence();
     void computePressure();
-    void computePressureForces(int i, int j, float* force_x, float* force_y);
     void computeVelocityBasedOnPressureForces();
-    void bilinearlyInterpolate(const int ii, const int jj, const float x, const float y);
     void computeVelocity(float force_x, float force_y);
     void computeObstructedFields();
-    const float InterpolateColor(int i, int j, int c, float w1, float w2, float w3, float w4);
-    const float InterpolateVelocity(int i, int j, int c, float w1, float w2, float w3, float w4);
-    const float InterpolateDensity(int i, int j, float w1, float w2, float w3, float w4);
-    const float getDensity(int i, int j);
-    const float getVelocity(int i, int j, int c);
-    const float getColor(int i, int j, int c);
-    const float getPressure(int i, int j);
-    const float getDivergence(int i, int j);
+    float* fieldBuffer(float* external, int components, float value);
+    float* rehomeField(float* field, int components);
+    void threadRows(int* j0, int* j1) const;
+    void buildFrozenStencil();
+    void advectFrozenColor(bool fuse_display);
+    void markChangedColor(int j);
+    void resampleColor();
+    void resetColorMap();
+    cfdFluidRuns solverRuns() const;
+    void advectSolidCells(float* colorOut, int j, int i0, int i1);
+    void markDirty(int i, int j) { dirtyTiles[tIndex(i,j)] = 1; }
+    void convertDisplayRow(const float* color, int j);
 };
 
 #endif //CFD_H
\ No newline at end of file
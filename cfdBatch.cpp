@@ -0,0 +1,311 @@
+//
+// A batch of CFD_BATCH_LANES same sized simulations stepped in lockstep.
+//
+// Every pass repeats the arithmetic of the matching cfd pass operation for
+// operation, so each lane rounds exactly like a cfd instance would.
+//
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "cfdBatch.h"
+#include "cfdKernels.h"
+#include "cfdUtility.h"
+#include "phaseTimer.h"
+
+static const int L = CFD_BATCH_LANES;
+
+
+static float* allocateLanes(size_t count, float value)
+{
+  void* memory = 0;
+  if (posix_memalign(&memory, 64, count * sizeof(float)) != 0)
+    throw std::bad_alloc();
+  float* field = (float*) memory;
+  for (size_t k = 0; k < count; ++k) { field[k] = value; }
+  return field;
+}
+
+
+cfdBatch::cfdBatch(const int nx, const int ny, const float dx, const float Dt, int Nloops, int Oploops)
+{
+  Nx = nx;
+  Ny = ny;
+  Dx = dx;
+  dt = Dt;
+  nloops = Nloops;
+  oploops = Oploops;
+  gravityX = 0.0f;
+  gravityY = 0.0f;
+  kernels = &cfdKernels();
+  const size_t cells = (size_t) Nx*Ny*L;
+  // the advected fields have one more cell of zeros after the grid, read by
+  // advection for samples off it
+  density1 = allocateLanes(cells + L, 0.0f);
+  density2 = allocateLanes(cells + L, 0.0f);
+  velocity1 = allocateLanes((cells + L)*2, 0.0f);
+  velocity2 = allocateLanes((cells + L)*2, 0.0f);
+  color1 = allocateLanes((cells + L)*3, 0.0f);
+  color2 = allocateLanes((cells + L)*3, 0.0f);
+  divergence = allocateLanes(cells, 0.0f);
+  pressure = allocateLanes(cells, 0.0f);
+  obstruction = allocateLanes(cells, 1.0f);
+  zeros = allocateLanes(L, 0.0f);
+  for (int l = 0; l < L; ++l)
+  {
+    densitySourceField[l] = 0;
+    colorSourceField[l] = 0;
+    obstructionSourceField[l] = 0;
+    divergenceSourceField[l] = 0;
+  }
+}
+
+
+cfdBatch::~cfdBatch()
+{
+  free(density1);
+  free(density2);
+  free(velocity1);
+  free(velocity2);
+  free(color1);
+  free(color2);
+  free(divergence);
+  free(pressure);
+  free(obstruction);
+  free(zeros);
+}
+
+
+void cfdBatch::copyLane(const float* field, int components, int lane, float* out) const
+{
+  const int count = Nx*Ny*components;
+  for (int k = 0; k < count; ++k) { out[k] = field[k*L + lane]; }
+}
+
+
+void cfdBatch::advect()
+{
+  CFD_TRACE_SCOPE("batch advect");
+  const cfdBatchAdvectFields f = { Nx, Ny, Dx, dt, density1, velocity1, color1, obstruction,
+                                   density2, velocity2, color2 };
+  for (int j = 0; j < Ny; ++j)
+    kernels->batchAdvectRow(f, j);
+
+  swapFloatPointers(&density1, &density2);
+  swapFloatPointers(&velocity1, &velocity2);
+  swapFloatPointers(&color1, &color2);
+}
+
+
+void cfdBatch::addSourceColor()
+{
+  for (int l = 0; l < L; ++l)
+  {
+    float* source = colorSourceField[l];
+    if (source == 0) { continue; }
+
+    for (int k = 0; k < Nx*Ny; ++k)
+    {
+      for (int c = 0; c < 3; ++c)
+      {
+        float& color = color1[(k*3+c)*L + l];
+        color += source[k*3+c] * obstruction[k*L + l];
+        // clamp color values to 1.0f
+        if (color > 1.0f)
+          color = 1.0f;
+      }
+    }
+    Initialize(source, Nx*Ny*3, 0.0);
+    colorSourceField[l] = 0;
+  }
+}
+
+
+void cfdBatch::addSourceDensity()
+{
+  for (int l = 0; l < L; ++l)
+  {
+    float* source = densitySourceField[l];
+    if (source == 0) { continue; }
+
+    for (int k = 0; k < Nx*Ny; ++k) { density1[k*L + l] += source[k] * obstruction[k*L + l]; }
+    Initialize(source, Nx*Ny, 0.0);
+    densitySourceField[l] = 0;
+  }
+}
+
+
+void cfdBatch::addSourceObstruction()
+{
+  for (int l = 0; l < L; ++l)
+  {
+    float* source = obstructionSourceField[l];
+    if (source == 0) { continue; }
+
+    for (int k = 0; k < Nx*Ny; ++k)
+    {
+      obstruction[k*L + l] *= source[k];
+      // remove color where the obstruction is
+      for (int c = 0; c < 3; ++c) { color1[(k*3+c)*L + l] *= source[k]; }
+    }
+    Initialize(source, Nx*Ny, 1.0);
+    obstructionSourceField[l] = 0;
+  }
+}
+
+
+void cfdBatch::computeVelocity(float force_x, float force_y)
+{
+  for (int k = 0; k < Nx*Ny; ++k)
+  {
+    float* v = velocity1 + k*2*L;
+    const float* d = density1 + k*L;
+#pragma omp simd
+    for (int l = 0; l < L; ++l)
+    {
+      v[l]     += (force_x * d[l]*dt);
+      v[L + l] += (force_y * d[l]*dt);
+    }
+  }
+}
+
+
+void cfdBatch::computeDivergence()
+{
+  CFD_TRACE_SCOPE("batch computeDivergence");
+  for (int j = 0; j < Ny; ++j)
+  {
+    for (int i = 0; i < Nx; ++i)
+    {
+      // neighbors outside the grid read a cell of zeros
+      const float* right = i+1 < Nx ? velocity1 + vIndex(i+1, j, 0) : zeros;
+      const float* left  = i > 0    ? velocity1 + vIndex(i-1, j, 0) : zeros;
+      const float* up    = j+1 < Ny ? velocity1 + vIndex(i, j+1, 1) : zeros;
+      const float* down  = j > 0    ? velocity1 + vIndex(i, j-1, 1) : zeros;
+      float* div = divergence + dIndex(i,j);
+#pragma omp simd
+      for (int l = 0; l < L; ++l)
+        div[l] = (right[l] - left[l]) / (2*Dx) + (up[l] - down[l]) / (2*Dx);
+    }
+  }
+
+  for (int l = 0; l < L; ++l)
+  {
+    float* source = divergenceSourceField[l];
+    if (source == 0) { continue; }
+
+    for (int k = 0; k < Nx*Ny; ++k) { divergence[k*L + l] += source[k]; }
+    Initialize(source, Nx*Ny, 0.0);
+    divergenceSourceField[l] = 0;
+  }
+}
+
+
+const float* cfdBatch::pressureAt(int i, int j) const
+{
+  if (i < Nx && i >= 0 && j < Ny && j >= 0)
+    return pressure + pIndex(i,j);
+  else
+    return zeros;
+}
+
+
+void cfdBatch::computePressure()
+{
+  CFD_TRACE_SCOPE("batch computePressure");
+  memset(pressure, 0, sizeof(float) * Nx*Ny*L);
+  const float scale = Dx*Dx/4.0f;
+
+  // Gauss-Seidel in the same order as cfd, so every lane sees the same mix
+  // of updated and old neighbors
+  for (int k = 0; k < nloops; ++k)
+  {
+    for (int j = 0; j < Ny; ++j)
+    {
+      for (int i = 0; i < Nx; ++i)
+      {
+        const float* right = pressureAt(i+1, j);
+        const float* left  = pressureAt(i-1, j);
+        const float* up    = pressureAt(i, j+1);
+        const float* down  = pressureAt(i, j-1);
+        const float* div   = divergence + dIndex(i,j);
+        float* p = pressure + pIndex(i,j);
+#pragma omp simd
+        for (int l = 0; l < L; ++l)
+          p[l] = ((right[l] + left[l] + up[l] + down[l]) * 0.25f) - (scale * div[l]);
+      }
+    }
+  }
+}
+
+
+void cfdBatch::computeVelocityBasedOnPressureForces()
+{
+  CFD_TRACE_SCOPE("batch computeVelocityBasedOnPressureForces");
+  for (int j = 0; j < Ny; ++j)
+  {
+    for (int i = 0; i < Nx; ++i)
+    {
+      const float* right = pressureAt(i+1, j);
+      const float* left  = pressureAt(i-1, j);
+      const float* up    = pressureAt(i, j+1);
+      const float* down  = pressureAt(i, j-1);
+      float* v = velocity1 + vIndex(i,j,0);
+#pragma omp simd
+      for (int l = 0; l < L; ++l)
+      {
+        v[l]     -= (right[l] - left[l]) / (2*Dx);
+        v[L + l] -= (up[l] - down[l]) / (2*Dx);
+      }
+    }
+  }
+}
+
+
+void cfdBatch::computeObstructedFields()
+{
+  for (int j = 0; j < Ny; ++j)
+  {
+    for (int i = 0; i < Nx; ++i)
+    {
+      float* v = velocity1 + vIndex(i,j,0);
+      float* d = density1 + dIndex(i,j);
+      const float* o = obstruction + oIndex(i,j);
+      // component 0 is scaled twice and component 1 not at all, as in cfd
+#pragma omp simd
+      for (int l = 0; l < L; ++l)
+      {
+        v[l] *= o[l];
+        v[l] *= o[l];
+        d[l] *= o[l];
+      }
+
+      // set boundaries
+      if (i == 0 || i == Nx-1)
+        memset(v, 0, sizeof(float) * L);
+      else if (j == 0 || j == Ny - 1)
+        memset(v + L, 0, sizeof(float) * L);
+    }
+  }
+}
+
+
+void cfdBatch::sources()
+{
+  CFD_TRACE_SCOPE("batch sources");
+  // add sources
+  addSourceColor();
+  addSourceDensity();
+  addSourceObstruction();
+
+  // compute sources
+  computeVelocity(gravityX, gravityY);
+
+  for (int i = 0; i < oploops; ++i)
+  {
+    computeDivergence();
+    computePressure();
+    computeVelocityBasedOnPressureForces();
+    computeObstructedFields();
+  }
+}
@@ -0,0 +1,96 @@
+//
+// A batch of CFD_BATCH_LANES same sized simulations stepped in lockstep.
+// Every field is interleaved by instance: the values of one cell of all
+// instances sit next to each other, so each pass works on a whole vector
+// of instances at a time. The stencil passes (divergence, pressure,
+// forces) load and store those vectors directly; advection gathers, since
+// every instance traces back to its own place, one vector of lanes at a
+// time through the cfd kernel table (cfdKernels.h).
+//
+// Steps give the same results as cfd, instance for instance. There is no
+// display fusion or dirty tile tracking, the batch is meant for headless
+// baking.
+//
+
+#ifndef CFDBATCH_H
+#define CFDBATCH_H
+
+// instances per batch. it can be set when building (16 fills an AVX-512
+// vector) but the library and everything including this header must agree
+#ifndef CFD_BATCH_LANES
+#define CFD_BATCH_LANES 8
+#endif
+
+struct cfdKernelTable;
+
+class cfdBatch
+{
+  public:
+    // constructors/destructors
+    cfdBatch(const int nx, const int ny, const float dx, const float dt, int Nloops, int Oploops);
+    ~cfdBatch();
+
+    // public methods
+    void advect();
+    void sources();
+    void step() { advect(); sources(); }
+
+    // getters: copy one instance out in the layout of cfd
+    int getNx()    const { return Nx; }
+    int getNy()    const { return Ny; }
+    int getLanes() const { return CFD_BATCH_LANES; }
+    void copyColor(int lane, float* out)       const { copyLane(color1, 3, lane, out); }
+    void copyDensity(int lane, float* out)     const { copyLane(density1, 1, lane, out); }
+    void copyVelocity(int lane, float* out)    const { copyLane(velocity1, 2, lane, out); }
+    void copyPressure(int lane, float* out)    const { copyLane(pressure, 1, lane, out); }
+    void copyDivergence(int lane, float* out)  const { copyLane(divergence, 1, lane, out); }
+    void copyObstruction(int lane, float* out) const { copyLane(obstruction, 1, lane, out); }
+
+    // setters: source fields of one instance, in the layout of cfd, and
+    // consumed by the next step just like cfd's
+    void setDensitySourceField(int lane, float* dsrc)     { densitySourceField[lane] = dsrc; }
+    void setColorSourceField(int lane, float* csrc)       { colorSourceField[lane] = csrc; }
+    void setObstructionSourceField(int lane, float* osrc) { obstructionSourceField[lane] = osrc; }
+    void setDivergenceSourceField(int lane, float* dsrc)  { divergenceSourceField[lane] = dsrc; }
+
+    // indexing: the first of CFD_BATCH_LANES values of a cell
+    int dIndex(int i, int j)        const { return (i+Nx*j)*CFD_BATCH_LANES; }
+    int pIndex(int i, int j)        const { return (i+Nx*j)*CFD_BATCH_LANES; }
+    int oIndex(int i, int j)        const { return (i+Nx*j)*CFD_BATCH_LANES; }
+    int vIndex(int i, int j, int c) const { return ((i+Nx*j)*2+c)*CFD_BATCH_LANES; }
+    int cIndex(int i, int j, int c) const { return ((i+Nx*j)*3+c)*CFD_BATCH_LANES; }
+
+  private:
+    int     Nx, Ny;
+    int     nloops; // number of loops for pressure calculation
+    int     oploops; // number of orthogonal projection loops
+    float   Dx;
+    float   dt;
+    float   gravityX, gravityY;
+    float   *density1, *density2;
+    float   *velocity1, *velocity2;
+    float   *color1, *color2;
+    float   *divergence;
+    float   *pressure;
+    float   *obstruction;
+    const cfdKernelTable *kernels; // the instruction set variant in use
+    float   *zeros; // one cell of lanes, read for neighbors outside the grid
+    float   *densitySourceField[CFD_BATCH_LANES];
+    float   *colorSourceField[CFD_BATCH_LANES];
+    float   *obstructionSourceField[CFD_BATCH_LANES];
+    float   *divergenceSourceField[CFD_BATCH_LANES];
+
+    // private methods
+    void addSourceColor();
+    void addSourceDensity();
+    void addSourceObstruction();
+    void computeDivergence();
+    void computePressure();
+    void computeVelocityBasedOnPressureForces();
+    void computeVelocity(float force_x, float force_y);
+    void computeObstructedFields();
+    const float* pressureAt(int i, int j) const;
+    void copyLane(const float* field, int components, int lane, float* out) const;
+};
+
+#endif //CFDBATCH_H
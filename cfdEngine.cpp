@@ -0,0 +1,74 @@
+//
+// Many independent cfd simulations stepped together on one workPool.
+//
+#include <algorithm>
+#include <chrono>
+#include "cfdEngine.h"
+
+
+cfdEngine::cfdEngine(int nthreads) : pool(nthreads)
+{
+  load.assign(pool.size(), 0.0);
+  balanced = true;
+  cellsStepped = 0.0;
+  secondsStepping = 0.0;
+}
+
+
+cfdEngine::~cfdEngine()
+{
+  for (size_t k = 0; k < instances.size(); ++k) { delete instances[k]; }
+}
+
+
+int cfdEngine::add(int nx, int ny, float dx, float dt, int nloops, int oploops)
+{
+  // built by its home worker itself, not a thief
+  const int least = (int) (std::min_element(load.begin(), load.end()) - load.begin());
+  cfd* created = 0;
+  pool.run(1, &least, [&](int) { created = new cfd(nx, ny, dx, dt, nloops, oploops); }, false);
+
+  instances.push_back(created);
+  home.push_back(least);
+  // advection and the other passes cost about as much as a few pressure loops
+  cost.push_back((double) nx*ny * (4 + nloops*oploops));
+  load[least] += cost.back();
+  balanced = false;
+  return (int) instances.size() - 1;
+}
+
+
+void cfdEngine::balance()
+{
+  // every instance stays on its home worker, where its memory is; add()
+  // already spread them by cost. queued smallest first, so each worker
+  // pops its largest instance first and thieves take small ones
+  std::vector<int> order(instances.size());
+  for (size_t k = 0; k < order.size(); ++k) { order[k] = (int) k; }
+  std::sort(order.begin(), order.end(), [this](int a, int b) { return cost[a] < cost[b]; });
+
+  queued = order;
+  owner.resize(order.size());
+  for (size_t k = 0; k < order.size(); ++k) { owner[k] = home[order[k]]; }
+  balanced = true;
+}
+
+
+void cfdEngine::step()
+{
+  if (instances.empty()) { return; }
+  if (!balanced) { balance(); }
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  pool.run((int) queued.size(), &owner[0], [this](int k) { instances[queued[k]]->step(); });
+  secondsStepping += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (size_t k = 0; k < instances.size(); ++k)
+    cellsStepped += (double) instances[k]->getNx() * instances[k]->getNy();
+}
+
+
+double cfdEngine::cellsPerSecond() const
+{
+  return secondsStepping > 0.0 ? cellsStepped / secondsStepping : 0.0;
+}
@@ -0,0 +1,54 @@
+//
+// Many independent cfd simulations stepped together on one workPool. Each
+// instance runs single threaded; throughput comes from stepping many of
+// them at once.
+//
+
+#ifndef CFDENGINE_H
+#define CFDENGINE_H
+
+#include <vector>
+#include "cfd.h"
+#include "workPool.h"
+
+class cfdEngine
+{
+  public:
+    // nthreads < 1 uses one thread per core
+    explicit cfdEngine(int nthreads);
+    ~cfdEngine();
+
+    // returns the id of the new instance, ids count up from 0. It is built
+    // on the least loaded worker, with the one thread OpenMP team it steps
+    // with, so its fields are first touched where it is stepped (see cfd.h)
+    int add(int nx, int ny, float dx, float dt, int nloops, int oploops);
+
+    // for setting sources and reading fields between steps
+    cfd& instance(int id) { return *instances[id]; }
+    int size()  const     { return (int) instances.size(); }
+    int threads() const   { return pool.size(); }
+
+    // one step of every instance
+    void step();
+
+    // cells advanced per second of wall time over all steps so far
+    double cellsPerSecond() const;
+    long long stolenSteps() const { return pool.stolenTasks(); }
+
+  private:
+    workPool          pool;
+    std::vector<cfd*> instances;
+    std::vector<double> cost;   // relative time of one step of each instance
+    std::vector<int>  home;     // worker each instance was built on
+    std::vector<double> load;   // cost of the instances at home on each worker
+    std::vector<int>  queued;   // instances smallest first, the order they are queued in
+    std::vector<int>  owner;    // worker each queued instance starts on, its home
+    bool              balanced;
+    double            cellsStepped;
+    double            secondsStepping;
+
+    // private methods
+    void balance();
+};
+
+#endif //CFDENGINE_H
@@ -0,0 +1,451 @@
+//
+// Bodies of the cfd kernels. Included once per instruction set by
+// cfdKernels.cpp with CFD_KERNEL(name) giving each copy its own names, so
+// there is deliberately no include guard. Do not include anything here:
+// functions from headers would be compiled for the wrong target.
+//
+// Edge cells take the bounds checked path of the original cfd passes, the
+// interior runs branch free so it vectorizes.
+//
+
+static inline float CFD_KERNEL(sample)(const float* field, int Nx, int Ny, int components, int c, int i, int j)
+{
+  if (i < Nx && i >= 0 && j < Ny && j >= 0)
+    return field[(i+Nx*j)*components+c];
+  else
+    return 0.0f;
+}
+
+
+// with_* are constants at every call, so each set of fields gets its own
+// copy of the loop without the tests
+static CFD_KERNEL_INLINE void CFD_KERNEL(advectRowFields)(const cfdAdvectFields& f, int j, int i0, int i1,
+                                                          bool with_density, bool with_velocity, bool with_color,
+                                                          bool with_map)
+{
+  const int Nx = f.Nx, Ny = f.Ny;
+  const float Dx = f.Dx, dt = f.dt;
+  const float *density = f.density, *velocity = f.velocity, *color = f.color, *obstruction = f.obstruction;
+  const float *map = f.map;
+  float *density2 = f.density2 + (with_density ? Nx*j : 0);
+  float *velocity2 = f.velocity2 + (with_velocity ? 2*Nx*j : 0);
+  float *color2 = f.color2 + (with_color ? 3*Nx*j : 0);
+  float *map2 = f.map2 + (with_map ? 2*Nx*j : 0);
+  const float *velocity_row = velocity + 2*Nx*j, *obstruction_row = obstruction + Nx*j;
+  const int map_x = Nx > 1 ? 1 : 0, map_y = Ny > 1 ? Nx : 0;
+  const int map_i = Nx > 1 ? Nx-2 : 0, map_j = Ny > 1 ? Ny-2 : 0;
+
+#ifdef __linux__
+#pragma omp simd
+#endif
+  for (int ii = i0; ii < i1; ++ii)
+  {
+    const float o = obstruction_row[ii];
+    const float x = ii*Dx - velocity_row[2*ii]*dt * o;
+    const float y = j*Dx - velocity_row[2*ii+1]*dt * o;
+
+    // get index of sample
+    const int i = (int) (x/Dx);
+    const int jj = (int) (y/Dx);
+
+    // get weights of samples
+    const float ax = std::abs(x/Dx - i);
+    const float ay = std::abs(y/Dx - jj);
+    const float w1 = (1-ax) * (1-ay);
+    const float w2 = ax * (1-ay);
+    const float w3 = (1-ax) * ay;
+    const float w4 = ax * ay;
+
+    // which of the four samples are on the grid, and a safe index for each
+    const bool in_i0 = i >= 0 && i < Nx, in_i1 = i+1 >= 0 && i+1 < Nx;
+    const bool in_j0 = jj >= 0 && jj < Ny, in_j1 = jj+1 >= 0 && jj+1 < Ny;
+    const bool in00 = in_i0 && in_j0, in10 = in_i1 && in_j0, in01 = in_i0 && in_j1, in11 = in_i1 && in_j1;
+    const int k00 = in00 ? i + Nx*jj : 0;
+    const int k10 = in10 ? i+1 + Nx*jj : 0;
+    const int k01 = in01 ? i + Nx*(jj+1) : 0;
+    const int k11 = in11 ? i+1 + Nx*(jj+1) : 0;
+
+    // obstruction of the sample cell, clamped to the grid
+    const int oi = i < 0 ? 0 : (i >= Nx ? Nx-1 : i);
+    const int oj = jj < 0 ? 0 : (jj >= Ny ? Ny-1 : jj);
+    const float so = obstruction[oi + Nx*oj];
+
+    if (with_density)
+    {
+      density2[ii] = (in00 ? density[k00] : 0.0f) * w1 * so +
+                     (in10 ? density[k10] : 0.0f) * w2 * so +
+                     (in01 ? density[k01] : 0.0f) * w3 * so +
+                     (in11 ? density[k11] : 0.0f) * w4 * so;
+    }
+    for (int c = 0; with_velocity && c < 2; ++c)
+    {
+      velocity2[2*ii+c] = (in00 ? velocity[2*k00+c] : 0.0f) * w1 * so +
+                          (in10 ? velocity[2*k10+c] : 0.0f) * w2 * so +
+                          (in01 ? velocity[2*k01+c] : 0.0f) * w3 * so +
+                          (in11 ? velocity[2*k11+c] : 0.0f) * w4 * so;
+    }
+    for (int c = 0; with_color && c < 3; ++c)
+    {
+      color2[3*ii+c] = (in00 ? color[3*k00+c] : 0.0f) * w1 +
+                       (in10 ? color[3*k10+c] : 0.0f) * w2 +
+                       (in01 ? color[3*k01+c] : 0.0f) * w3 +
+                       (in11 ? color[3*k11+c] : 0.0f) * w4;
+    }
+    if (with_map)
+    {
+      // the map is sampled clamped to the grid, plus what the backtrace
+      // overshoots it by. lerped as a + (b-a)*t, which on the identity map
+      // gives the backtrace exactly, so one step resamples as advect
+      const float mx = x/Dx, my = y/Dx;
+      const float cx = mx < 0.0f ? 0.0f : (mx > Nx-1 ? (float) (Nx-1) : mx);
+      const float cy = my < 0.0f ? 0.0f : (my > Ny-1 ? (float) (Ny-1) : my);
+      const int mi = (int) cx < map_i ? (int) cx : map_i;
+      const int mj = (int) cy < map_j ? (int) cy : map_j;
+      const float bx = cx - mi, by = cy - mj;
+      const float* m = map + 2*(mi + Nx*mj);
+      for (int c = 0; c < 2; ++c)
+      {
+        const float m0 = m[c] + (m[2*map_x+c] - m[c]) * bx;
+        const float m1 = m[2*map_y+c] + (m[2*(map_x+map_y)+c] - m[2*map_y+c]) * bx;
+        map2[2*ii+c] = m0 + (m1 - m0) * by + (c == 0 ? mx - cx : my - cy);
+      }
+    }
+  }
+}
+
+
+static void CFD_KERNEL(advectRow)(const cfdAdvectFields& f, int j, int i0, int i1)
+{
+  const bool d = f.density2 != 0, v = f.velocity2 != 0, c = f.color2 != 0, m = f.map2 != 0;
+  if (d && v && c && !m)
+    CFD_KERNEL(advectRowFields)(f, j, i0, i1, true, true, true, false);
+  else if (!d && v && c && !m)
+    CFD_KERNEL(advectRowFields)(f, j, i0, i1, false, true, true, false);
+  else if (!d && !v && c && !m)
+    CFD_KERNEL(advectRowFields)(f, j, i0, i1, false, false, true, false);
+  else if (d && v && !c && m)
+    CFD_KERNEL(advectRowFields)(f, j, i0, i1, true, true, false, true);
+  else if (!d && v && !c && m)
+    CFD_KERNEL(advectRowFields)(f, j, i0, i1, false, true, false, true);
+  else
+    CFD_KERNEL(advectRowFields)(f, j, i0, i1, d, v, c, m);
+}
+
+
+static void CFD_KERNEL(computeVelocity)(float* velocity, const float* density, int cells,
+                                        float force_x, float force_y, float dt)
+{
+#ifdef __linux__
+#pragma omp simd
+#endif
+  for (int k = 0; k < cells; ++k)
+  {
+    velocity[2*k]   += (force_x * density[k]*dt);
+    velocity[2*k+1] += (force_y * density[k]*dt);
+  }
+}
+
+
+static inline float CFD_KERNEL(divergenceAt)(const float* velocity, int Nx, int Ny, float Dx, int i, int j)
+{
+  return (CFD_KERNEL(sample)(velocity, Nx, Ny, 2, 0, i+1, j) -
+          CFD_KERNEL(sample)(velocity, Nx, Ny, 2, 0, i-1, j)) / (2*Dx) +
+         (CFD_KERNEL(sample)(velocity, Nx, Ny, 2, 1, i, j+1) -
+          CFD_KERNEL(sample)(velocity, Nx, Ny, 2, 1, i, j-1)) / (2*Dx);
+}
+
+
+static void CFD_KERNEL(computeDivergence)(const float* velocity, float* divergence, int Nx, int Ny, float Dx,
+                                          int j0, int j1, const cfdFluidRuns& runs)
+{
+  for (int j = j0; j < j1; ++j)
+  {
+    float* div = divergence + Nx*j;
+    const bool edge_row = j == 0 || j == Ny-1 || Nx < 3;
+    const float *row = velocity + 2*Nx*j, *up = row + 2*Nx, *down = row - 2*Nx;
+    int done = 0;
+    for (int r = runs.rowRun[j]; r < runs.rowRun[j+1]; ++r)
+    {
+      const int i0 = runs.run[2*r], i1 = runs.run[2*r+1];
+      for (int i = done; i < i0; ++i) { div[i] = 0.0f; }
+      done = i1;
+      if (edge_row)
+      {
+        for (int i = i0; i < i1; ++i) { div[i] = CFD_KERNEL(divergenceAt)(velocity, Nx, Ny, Dx, i, j); }
+        continue;
+      }
+
+      if (i0 == 0)
+        div[0] = CFD_KERNEL(divergenceAt)(velocity, Nx, Ny, Dx, 0, j);
+      const int lo = i0 > 1 ? i0 : 1, hi = i1 < Nx-1 ? i1 : Nx-1;
+#ifdef __linux__
+#pragma omp simd
+#endif
+      for (int i = lo; i < hi; ++i)
+        div[i] = (row[2*(i+1)] - row[2*(i-1)]) / (2*Dx) + (up[2*i+1] - down[2*i+1]) / (2*Dx);
+      if (i1 == Nx)
+        div[Nx-1] = CFD_KERNEL(divergenceAt)(velocity, Nx, Ny, Dx, Nx-1, j);
+    }
+    for (int i = done; i < Nx; ++i) { div[i] = 0.0f; }
+  }
+}
+
+
+static void CFD_KERNEL(computePressure)(float* pressure, const float* divergence, int Nx, int Ny, float Dx, int nloops,
+                                        const cfdFluidRuns& runs)
+{
+  const float scale = Dx*Dx/4.0f;
+
+  // Gauss-Seidel: each cell reads the already updated cell to its left, so
+  // the rows stay sequential. the interior just drops the bounds checks
+  for (int k = 0; k < nloops; ++k)
+  {
+    for (int j = 0; j < Ny; ++j)
+    {
+      float* p = pressure + Nx*j;
+      const float* div = divergence + Nx*j;
+      const bool edge_row = j == 0 || j == Ny-1 || Nx < 3;
+      const float *up = p + Nx, *down = p - Nx;
+      for (int r = runs.rowRun[j]; r < runs.rowRun[j+1]; ++r)
+      {
+        const int i0 = runs.run[2*r], i1 = runs.run[2*r+1];
+        if (edge_row)
+        {
+          for (int i = i0; i < i1; ++i)
+          {
+            p[i] = ((CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i+1, j) +
+                     CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i-1, j) +
+                     CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i, j+1) +
+                     CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i, j-1)) * 0.25f) - (scale * div[i]);
+          }
+          continue;
+        }
+
+        if (i0 == 0)
+          p[0] = ((p[1] + 0.0f + up[0] + down[0]) * 0.25f) - (scale * div[0]);
+        const int lo = i0 > 1 ? i0 : 1, hi = i1 < Nx-1 ? i1 : Nx-1;
+        for (int i = lo; i < hi; ++i)
+          p[i] = ((p[i+1] + p[i-1] + up[i] + down[i]) * 0.25f) - (scale * div[i]);
+        if (i1 == Nx)
+          p[Nx-1] = ((0.0f + p[Nx-2] + up[Nx-1] + down[Nx-1]) * 0.25f) - (scale * div[Nx-1]);
+      }
+    }
+  }
+}
+
+
+static inline void CFD_KERNEL(pressureForceAt)(const float* pressure, float* velocity, int Nx, int Ny, float Dx, int i, int j)
+{
+  velocity[2*(i+Nx*j)]   -= (CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i+1, j) -
+                             CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i-1, j)) / (2*Dx);
+  velocity[2*(i+Nx*j)+1] -= (CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i, j+1) -
+                             CFD_KERNEL(sample)(pressure, Nx, Ny, 1, 0, i, j-1)) / (2*Dx);
+}
+
+
+static void CFD_KERNEL(applyPressureForces)(const float* pressure, float* velocity, int Nx, int Ny, float Dx,
+                                            int j0, int j1, const cfdFluidRuns& runs)
+{
+  for (int j = j0; j < j1; ++j)
+  {
+    const bool edge_row = j == 0 || j == Ny-1 || Nx < 3;
+    float* v = velocity + 2*Nx*j;
+    const float *p = pressure + Nx*j, *up = p + Nx, *down = p - Nx;
+    for (int r = runs.rowRun[j]; r < runs.rowRun[j+1]; ++r)
+    {
+      const int i0 = runs.run[2*r], i1 = runs.run[2*r+1];
+      if (edge_row)
+      {
+        for (int i = i0; i < i1; ++i) { CFD_KERNEL(pressureForceAt)(pressure, velocity, Nx, Ny, Dx, i, j); }
+        continue;
+      }
+
+      if (i0 == 0)
+        CFD_KERNEL(pressureForceAt)(pressure, velocity, Nx, Ny, Dx, 0, j);
+      const int lo = i0 > 1 ? i0 : 1, hi = i1 < Nx-1 ? i1 : Nx-1;
+#ifdef __linux__
+#pragma omp simd
+#endif
+      for (int i = lo; i < hi; ++i)
+      {
+        v[2*i]   -= (p[i+1] - p[i-1]) / (2*Dx);
+        v[2*i+1] -= (up[i] - down[i]) / (2*Dx);
+      }
+      if (i1 == Nx)
+        CFD_KERNEL(pressureForceAt)(pressure, velocity, Nx, Ny, Dx, Nx-1, j);
+    }
+  }
+}
+
+
+static void CFD_KERNEL(applyObstruction)(float* velocity, float* density, const float* obstruction, int Nx, int Ny,
+                                         int j0, int j1)
+{
+  if (j0 >= j1)
+    return;
+
+  // component 0 is scaled twice and component 1 not at all, as cfd always has
+#ifdef __linux__
+#pragma omp simd
+#endif
+  for (int k = Nx*j0; k < Nx*j1; ++k)
+  {
+    velocity[2*k] *= obstruction[k];
+    velocity[2*k] *= obstruction[k];
+  }
+  if (density != 0)
+  {
+#ifdef __linux__
+#pragma omp simd
+#endif
+    for (int k = Nx*j0; k < Nx*j1; ++k) { density[k] *= obstruction[k]; }
+  }
+
+  // set boundaries
+  for (int j = j0; j < j1; ++j)
+  {
+    velocity[2*(Nx*j)] = 0.0f;
+    velocity[2*(Nx-1 + Nx*j)] = 0.0f;
+  }
+  for (int i = 1; i < Nx-1; ++i)
+  {
+    if (j0 == 0)
+      velocity[2*i+1] = 0.0f;
+    if (j1 == Ny)
+      velocity[2*(i + Nx*(Ny-1))+1] = 0.0f;
+  }
+}
+
+
+static void CFD_KERNEL(resampleColorRow)(const float* color, const float* map, float* color2, int Nx, int Ny, int j)
+{
+  const float* map_row = map + 2*Nx*j;
+  float* out = color2 + 3*Nx*j;
+
+#ifdef __linux__
+#pragma omp simd
+#endif
+  for (int ii = 0; ii < Nx; ++ii)
+  {
+    // samples and weights the way advectRowFields takes them, truncated
+    // toward zero
+    const float x = map_row[2*ii], y = map_row[2*ii+1];
+    const int i = (int) x, jj = (int) y;
+    const float ax = std::abs(x - i), ay = std::abs(y - jj);
+    const float w1 = (1-ax) * (1-ay);
+    const float w2 = ax * (1-ay);
+    const float w3 = (1-ax) * ay;
+    const float w4 = ax * ay;
+
+    const bool in_i0 = i >= 0 && i < Nx, in_i1 = i+1 >= 0 && i+1 < Nx;
+    const bool in_j0 = jj >= 0 && jj < Ny, in_j1 = jj+1 >= 0 && jj+1 < Ny;
+    const bool in00 = in_i0 && in_j0, in10 = in_i1 && in_j0, in01 = in_i0 && in_j1, in11 = in_i1 && in_j1;
+    const int k00 = in00 ? i + Nx*jj : 0;
+    const int k10 = in10 ? i+1 + Nx*jj : 0;
+    const int k01 = in01 ? i + Nx*(jj+1) : 0;
+    const int k11 = in11 ? i+1 + Nx*(jj+1) : 0;
+
+    for (int c = 0; c < 3; ++c)
+    {
+      out[3*ii+c] = (in00 ? color[3*k00+c] : 0.0f) * w1 +
+                    (in10 ? color[3*k10+c] : 0.0f) * w2 +
+                    (in01 ? color[3*k01+c] : 0.0f) * w3 +
+                    (in11 ? color[3*k11+c] : 0.0f) * w4;
+    }
+  }
+}
+
+
+// the four samples of one batch value, weighted in the order advectRowFields
+// weights them, for the fields scaled by the obstruction and for color
+static CFD_KERNEL_INLINE float CFD_KERNEL(batchSample)(const float* field, int k00, int k10, int k01, int k11,
+                                                       float w1, float w2, float w3, float w4, float so)
+{
+  return field[k00] * w1 * so + field[k10] * w2 * so + field[k01] * w3 * so + field[k11] * w4 * so;
+}
+
+
+static CFD_KERNEL_INLINE float CFD_KERNEL(batchSampleColor)(const float* field, int k00, int k10, int k01, int k11,
+                                                            float w1, float w2, float w3, float w4)
+{
+  return field[k00] * w1 + field[k10] * w2 + field[k01] * w3 + field[k11] * w4;
+}
+
+
+// every lane of every cell of the row. each lane samples its own instance
+// with the samples and weights of advectRowFields; samples off the grid
+// read the cell of zeros after it (see cfdBatchAdvectFields) instead of
+// being selected away, so a lane only ever picks between indices
+static void CFD_KERNEL(batchAdvectRow)(const cfdBatchAdvectFields& f, int jj)
+{
+  const int L = CFD_BATCH_LANES;
+  const int Nx = f.Nx, Ny = f.Ny;
+  const float Dx = f.Dx, dt = f.dt;
+  const float *density = f.density, *velocity = f.velocity, *color = f.color, *obstruction = f.obstruction;
+  float *density2 = f.density2 + L*Nx*jj;
+  float *velocity2 = f.velocity2 + 2*L*Nx*jj;
+  float *color2 = f.color2 + 3*L*Nx*jj;
+  const float *velocity_row = velocity + 2*L*Nx*jj, *obstruction_row = obstruction + L*Nx*jj;
+
+  for (int ii = 0; ii < Nx; ++ii)
+  {
+#ifdef __linux__
+#pragma omp simd
+#endif
+    for (int l = 0; l < L; ++l)
+    {
+      const float o = obstruction_row[L*ii + l];
+      const float x = ii*Dx - velocity_row[2*L*ii + l]*dt * o;
+      const float y = jj*Dx - velocity_row[2*L*ii + L + l]*dt * o;
+
+      // get index of sample
+      const int i = (int) (x/Dx);
+      const int j = (int) (y/Dx);
+
+      // get weights of samples
+      const float ax = std::abs(x/Dx - i);
+      const float ay = std::abs(y/Dx - j);
+      const float w1 = (1-ax) * (1-ay);
+      const float w2 = ax * (1-ay);
+      const float w3 = (1-ax) * ay;
+      const float w4 = ax * ay;
+
+      // the four sample cells, or the cell of zeros for those off the grid
+      const bool in_i0 = (i >= 0) & (i < Nx), in_i1 = (i+1 >= 0) & (i+1 < Nx);
+      const bool in_j0 = (j >= 0) & (j < Ny), in_j1 = (j+1 >= 0) & (j+1 < Ny);
+      const int k00 = in_i0 & in_j0 ? i + Nx*j : Nx*Ny;
+      const int k10 = in_i1 & in_j0 ? i+1 + Nx*j : Nx*Ny;
+      const int k01 = in_i0 & in_j1 ? i + Nx*(j+1) : Nx*Ny;
+      const int k11 = in_i1 & in_j1 ? i+1 + Nx*(j+1) : Nx*Ny;
+
+      // obstruction of the sample cell, clamped to the grid
+      const int oi = i < 0 ? 0 : (i >= Nx ? Nx-1 : i);
+      const int oj = j < 0 ? 0 : (j >= Ny ? Ny-1 : j);
+      const float so = obstruction[L*(oi + Nx*oj) + l];
+
+      // the values of a cell are L floats apart, lane l of each
+      const int d00 = L*k00 + l, d10 = L*k10 + l, d01 = L*k01 + l, d11 = L*k11 + l;
+      const int v00 = d00 + L*k00, v10 = d10 + L*k10, v01 = d01 + L*k01, v11 = d11 + L*k11;
+      const int c00 = v00 + L*k00, c10 = v10 + L*k10, c01 = v01 + L*k01, c11 = v11 + L*k11;
+      density2[L*ii + l] = CFD_KERNEL(batchSample)(density, d00, d10, d01, d11, w1, w2, w3, w4, so);
+      velocity2[L*(2*ii) + l] = CFD_KERNEL(batchSample)(velocity, v00, v10, v01, v11, w1, w2, w3, w4, so);
+      velocity2[L*(2*ii+1) + l] = CFD_KERNEL(batchSample)(velocity + L, v00, v10, v01, v11, w1, w2, w3, w4, so);
+      color2[L*(3*ii) + l] = CFD_KERNEL(batchSampleColor)(color, c00, c10, c01, c11, w1, w2, w3, w4);
+      color2[L*(3*ii+1) + l] = CFD_KERNEL(batchSampleColor)(color + L, c00, c10, c01, c11, w1, w2, w3, w4);
+      color2[L*(3*ii+2) + l] = CFD_KERNEL(batchSampleColor)(color + 2*L, c00, c10, c01, c11, w1, w2, w3, w4);
+    }
+  }
+}
+
+static const cfdKernelTable CFD_KERNEL(table) =
+{
+  CFD_KERNEL_NAME,
+  CFD_KERNEL(advectRow),
+  CFD_KERNEL(computeVelocity),
+  CFD_KERNEL(computeDivergence),
+  CFD_KERNEL(computePressure),
+  CFD_KERNEL(applyPressureForces),
+  CFD_KERNEL(applyObstruction),
+  CFD_KERNEL(resampleColorRow),
+  CFD_KERNEL(batchAdvectRow),
+};
@@ -0,0 +1,133 @@
+//
+// Builds the cfd kernels once per instruction set and picks one at run time.
+//
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "cfdKernels.h"
+#include "cfdBatch.h"
+
+// keep a*b+c as two roundings in every variant, or results would depend
+// on which one runs. GCC ignores the STDC pragma and contracts into FMA
+// under the avx2 and avx512 targets, so it is also built with
+// -ffp-contract=off (CMakeLists.txt, build)
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CFD_KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define CFD_KERNEL_INLINE inline
+#endif
+
+#define CFD_KERNEL(name) name##_generic
+#define CFD_KERNEL_NAME "generic"
+#include "cfdKernelBodies.h"
+#undef CFD_KERNEL
+#undef CFD_KERNEL_NAME
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CFD_KERNEL_VARIANTS
+
+#ifdef __clang__
+#pragma clang attribute push (__attribute__((target("sse4.2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#endif
+#define CFD_KERNEL(name) name##_sse42
+#define CFD_KERNEL_NAME "sse4.2"
+#include "cfdKernelBodies.h"
+#undef CFD_KERNEL
+#undef CFD_KERNEL_NAME
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#ifdef __clang__
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+#define CFD_KERNEL(name) name##_avx2
+#define CFD_KERNEL_NAME "avx2"
+#include "cfdKernelBodies.h"
+#undef CFD_KERNEL
+#undef CFD_KERNEL_NAME
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#ifdef __clang__
+#pragma clang attribute push (__attribute__((target("avx512f,prefer-vector-width=512"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f,prefer-vector-width=512")
+#endif
+#define CFD_KERNEL(name) name##_avx512
+#define CFD_KERNEL_NAME "avx512"
+#include "cfdKernelBodies.h"
+#undef CFD_KERNEL
+#undef CFD_KERNEL_NAME
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+
+const cfdKernelTable* cfdKernelVariant(const char* name)
+{
+  if (strcmp(name, "generic") == 0)
+    return &table_generic;
+#ifdef CFD_KERNEL_VARIANTS
+  __builtin_cpu_init();
+  if (strcmp(name, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2"))
+    return &table_sse42;
+  if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    return &table_avx2;
+  if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f"))
+    return &table_avx512;
+#endif
+  return 0;
+}
+
+
+static const cfdKernelTable* pickKernels()
+{
+  const char* forced = getenv("CFD_ISA");
+  if (forced != 0 && forced[0] != '\0')
+  {
+    const cfdKernelTable* table = cfdKernelVariant(forced);
+    if (table != 0)
+      return table;
+    fprintf(stderr, "Warning: CFD_ISA=%s is unknown or not supported here, picking automatically\n", forced);
+  }
+
+  const char* best[] = { "avx512", "avx2", "sse4.2", "generic" };
+  for (int k = 0; k < 4; ++k)
+  {
+    const cfdKernelTable* table = cfdKernelVariant(best[k]);
+    if (table != 0)
+      return table;
+  }
+  return &table_generic;
+}
+
+
+const cfdKernelTable& cfdKernels()
+{
+  static const cfdKernelTable* table = pickKernels();
+  return *table;
+}
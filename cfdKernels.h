@@ -0,0 +1,97 @@
+//
+// The hot loops of cfd, built several times for different instruction sets
+// into one binary. The best variant the CPU supports is picked on first
+// use; set CFD_ISA to generic, sse4.2, avx2 or avx512 to force one.
+//
+// Every variant does the same float operations in the same order as the
+// generic one (no reassociation, no fused multiply-add), so results are
+// identical whichever runs.
+//
+
+#ifndef CFDKERNELS_H
+#define CFDKERNELS_H
+
+// fields read and written by one row of advection. a 0 output (density2,
+// velocity2, color2, map2) skips that field; its input may then be 0 too.
+// map holds, per cell, the position (in cells) in the last resampled color
+// that its color comes from; map2 gets it followed back along this step's
+// backtrace. map is sampled clamped to the grid and the overshoot kept, so
+// color from off the grid still reads as 0 when resampled
+struct cfdAdvectFields
+{
+  int   Nx, Ny;
+  float Dx, dt;
+  const float *density, *velocity, *color, *obstruction, *map;
+  float *density2, *velocity2, *color2, *map2;
+};
+
+// the same fields for one row of cfdBatch, whose values are interleaved by
+// instance: CFD_BATCH_LANES values per cell, see cfdBatch.h. density,
+// velocity and color hold one more cell after the grid, all zeros
+struct cfdBatchAdvectFields
+{
+  int   Nx, Ny;
+  float Dx, dt;
+  const float *density, *velocity, *color, *obstruction;
+  float *density2, *velocity2, *color2;
+};
+
+// The cells the stencil passes work on, as runs of columns per row: row j
+// has the runs [run[2r], run[2r+1]) for r from rowRun[j] to rowRun[j+1]-1,
+// left to right. With every cell in one run per row the passes do exactly
+// what they did before there were runs.
+struct cfdFluidRuns
+{
+  const int *rowRun;
+  const int *run;
+};
+
+struct cfdKernelTable
+{
+  const char *name;
+
+  // semi-Lagrangian advection of density, velocity and color for columns
+  // [i0, i1) of row j, and composition of the deferred color map
+  void (*advectRow)(const cfdAdvectFields& f, int j, int i0, int i1);
+
+  // velocity += force * density * dt
+  void (*computeVelocity)(float* velocity, const float* density, int cells,
+                          float force_x, float force_y, float dt);
+
+  // The stencil passes below work on rows [j0, j1) so that threads can
+  // split the grid between them; they still read neighbours outside it.
+  // They only update the cells in runs.
+
+  // central difference divergence of velocity, zero outside the grid and
+  // between runs
+  void (*computeDivergence)(const float* velocity, float* divergence, int Nx, int Ny, float Dx,
+                            int j0, int j1, const cfdFluidRuns& runs);
+
+  // nloops Gauss-Seidel sweeps of the pressure Poisson equation, in place
+  void (*computePressure)(float* pressure, const float* divergence, int Nx, int Ny, float Dx, int nloops,
+                          const cfdFluidRuns& runs);
+
+  // velocity -= pressure gradient
+  void (*applyPressureForces)(const float* pressure, float* velocity, int Nx, int Ny, float Dx,
+                              int j0, int j1, const cfdFluidRuns& runs);
+
+  // scale by obstruction and clear the velocity at the walls. density may be 0
+  void (*applyObstruction)(float* velocity, float* density, const float* obstruction, int Nx, int Ny,
+                           int j0, int j1);
+
+  // deferred color: row j of color2 gathered bilinearly from color at the
+  // positions in map (see cfdAdvectFields), 0 off the grid
+  void (*resampleColorRow)(const float* color, const float* map, float* color2, int Nx, int Ny, int j);
+
+  // advectRow for every instance of a cfdBatch, row j
+  void (*batchAdvectRow)(const cfdBatchAdvectFields& f, int j);
+};
+
+// the variant in use, chosen on the first call
+const cfdKernelTable& cfdKernels();
+
+// a variant by name ("generic", "sse4.2", "avx2", "avx512"), or 0 if it is
+// unknown, not built in, or not supported by this CPU
+const cfdKernelTable* cfdKernelVariant(const char* name);
+
+#endif //CFDKERNELS_H
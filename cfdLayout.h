@@ -0,0 +1,128 @@
+//
+// Memory orders for a 2D field other than the row-major one cfd uses
+// (dIndex, vIndex and cIndex), to measure whether gathers that stay close
+// in 2D, like the advection backtraces, keep to fewer cache lines in them.
+//
+// LAYOUT_BLOCKED stores square blocks of 2^shift cells one after another,
+// row-major inside and between the blocks. LAYOUT_MORTON interleaves the
+// bits of i and j (Z-order) over the smallest power of two square that
+// holds the grid. Both pad the grid, so size fields with cells().
+//
+// cfd itself stays row-major: hosts read its fields directly. See
+// cfd_layout_bench for how these compare with it.
+//
+
+#ifndef CFDLAYOUT_H
+#define CFDLAYOUT_H
+
+#include <cstddef>
+#include <string>
+
+enum cfdLayout
+{
+  LAYOUT_ROW_MAJOR,
+  LAYOUT_BLOCKED,
+  LAYOUT_MORTON
+};
+
+
+// the bits of x (up to 16) spread out to the even bits
+inline unsigned int mortonSpread(unsigned int x)
+{
+  x &= 0xffffu;
+  x = (x | (x << 8)) & 0x00ff00ffu;
+  x = (x | (x << 4)) & 0x0f0f0f0fu;
+  x = (x | (x << 2)) & 0x33333333u;
+  x = (x | (x << 1)) & 0x55555555u;
+  return x;
+}
+
+
+struct fieldLayout
+{
+  cfdLayout kind;
+  int       Nx, Ny;
+  int       shift;   // log2 of the block edge, LAYOUT_BLOCKED
+  int       blocksX;
+  int       side;    // edge of the square LAYOUT_MORTON covers
+
+  // cell (i,j); multiply by the components for vector fields, as vIndex does
+  size_t index(int i, int j) const
+  {
+    switch (kind)
+    {
+      case LAYOUT_BLOCKED:
+      {
+        const int mask = (1 << shift) - 1;
+        const size_t block = (size_t) (i >> shift) + (size_t) blocksX * (j >> shift);
+        return (block << (2*shift)) | (size_t) ((j & mask) << shift) | (size_t) (i & mask);
+      }
+      case LAYOUT_MORTON:
+        return (size_t) mortonSpread(i) | ((size_t) mortonSpread(j) << 1);
+      default:
+        return (size_t) i + (size_t) Nx * j;
+    }
+  }
+
+  // cells to allocate, padding included
+  size_t cells() const
+  {
+    switch (kind)
+    {
+      case LAYOUT_BLOCKED:
+      {
+        const size_t blocksY = (Ny + (1 << shift) - 1) >> shift;
+        return ((size_t) blocksX * blocksY) << (2*shift);
+      }
+      case LAYOUT_MORTON:
+        return (size_t) side * side;
+      default:
+        return (size_t) Nx * Ny;
+    }
+  }
+};
+
+
+// block is the LAYOUT_BLOCKED edge in cells, a power of two. Morton grids
+// are limited to 65536 on a side
+inline fieldLayout makeFieldLayout(cfdLayout kind, int nx, int ny, int block)
+{
+  fieldLayout layout;
+  layout.kind = kind;
+  layout.Nx = nx;
+  layout.Ny = ny;
+  layout.shift = 0;
+  while ((1 << layout.shift) < block) { ++layout.shift; }
+  layout.blocksX = (nx + (1 << layout.shift) - 1) >> layout.shift;
+  layout.side = 1;
+  while (layout.side < nx || layout.side < ny) { layout.side *= 2; }
+  return layout;
+}
+
+
+inline const char* cfdLayoutName(cfdLayout kind)
+{
+  switch (kind)
+  {
+    case LAYOUT_BLOCKED: return "blocked";
+    case LAYOUT_MORTON:  return "morton";
+    default:             return "row-major";
+  }
+}
+
+
+// returns 0, or -1 if name is not row-major, blocked or morton
+inline int parseLayout(const std::string& name, cfdLayout& kind)
+{
+  if (name == "row-major")
+    kind = LAYOUT_ROW_MAJOR;
+  else if (name == "blocked")
+    kind = LAYOUT_BLOCKED;
+  else if (name == "morton")
+    kind = LAYOUT_MORTON;
+  else
+    return -1;
+  return 0;
+}
+
+#endif //CFDLAYOUT_H
@@ -0,0 +1,83 @@
+//
+// The original scalar solver, kept unchanged as the golden reference that
+// optimized cfd kernels are checked against (see cfd_verify). Do not
+// optimize this file. The one change from the original is getObstruction,
+// which stops samples traced off the grid reading outside obstruction.
+//
+
+#ifndef CFDREFERENCE_H
+#define CFDREFERENCE_H
+
+class cfdReference
+{
+  public:
+    // constructors/destructors
+    cfdReference(const int nx, const int ny, const float dx, const float dt, int Nloops, int Oploops);
+    ~cfdReference();
+
+    // public methods
+    void advect();
+    void sources();
+
+    // getters
+    float* getColorPointer()       const { return color1; }
+    float* getDensityPointer()     const { return density1; }
+    float* getVelocityPointer()    const { return velocity1; }
+    float* getPressurePointer()    const { return pressure; }
+    float* getDivergencePointer()  const { return divergence; }
+    float* getObstructionPointer() const { return obstruction; }
+
+    // setters
+    void setDensitySourceField(float* dsrc)     { densitySourceField = dsrc; }
+    void setColorSourceField(float* csrc)       { colorSourceField = csrc; }
+    void setObstructionSourceField(float* osrc) { obstructionSourceField = osrc; }
+    void setDivergenceSourceField(float* dsrc) { divergenceSourceField = dsrc; }
+
+    // indexing
+    int dIndex(int i, int j)        const { return i+Nx*j; }
+    int pIndex(int i, int j)        const { return i+Nx*j; }
+    int oIndex(int i, int j)        const { return i+Nx*j; }
+    int vIndex(int i, int j, int c) const { return (i+Nx*j)*2+c; }
+    int cIndex(int i, int j, int c) const { return (i+Nx*j)*3+c; }
+
+  private:
+    int     Nx, Ny;
+    int     nloops; // number of loops for pressure calculation
+    int     oploops; // number of orthogonal projection loops
+    float   Dx;
+    float   dt;
+    float   gravityX, gravityY;
+    float   *density1, *density2;
+    float   *velocity1, *velocity2;
+    float   *color1, *color2;
+    float   *divergence;
+    float   *pressure;
+    float   *obstruction;
+    float   *densitySourceField;
+    float   *colorSourceField;
+    float   *obstructionSourceField;
+    float   *divergenceSourceField;
+
+    // private methods
+    void addSourceColor();
+    void addSourceDensity();
+    void addSourceObstruction();
+    void computeDivergence();
+    void computePressure();
+    void computePressureForces(int i, int j, float* force_x, float* force_y);
+    void computeVelocityBasedOnPressureForces();
+    void bilinearlyInterpolate(const int ii, const int jj, const float x, const float y);
+    void computeVelocity(float force_x, float force_y);
+    void computeObstructedFields();
+    const float InterpolateColor(int i, int j, int c, float w1, float w2, float w3, float w4);
+    const float InterpolateVelocity(int i, int j, int c, float w1, float w2, float w3, float w4);
+    const float InterpolateDensity(int i, int j, float w1, float w2, float w3, float w4);
+    const float getDensity(int i, int j);
+    const float getVelocity(int i, int j, int c);
+    const float getColor(int i, int j, int c);
+    const float getPressure(int i, int j);
+    const float getDivergence(int i, int j);
+    const float getObstruction(int i, int j);
+};
+
+#endif //CFDREFERENCE_H
\ No newline at end of file
@@ -0,0 +1,140 @@
+//
+// Seeded, repeatable solver scenarios.
+//
+#include "brush.h"
+#include "cfdScenario.h"
+
+
+static scenarioDab makeDab(int step, int mode, int x, int y)
+{
+  scenarioDab d;
+  d.step = step;
+  d.mode = mode;
+  d.x = x;
+  d.y = y;
+  return d;
+}
+
+
+static cfdScenario makeScenario(const std::string& name, int nx, int ny, int nloops, int oploops, int steps)
+{
+  cfdScenario s;
+  s.name = name;
+  s.nx = nx;
+  s.ny = ny;
+  s.nloops = nloops;
+  s.oploops = oploops;
+  s.dt = (float) (1.0/24.0);
+  s.steps = steps;
+  s.brushSize = 11;
+  return s;
+}
+
+
+std::vector<cfdScenario> defaultScenarios()
+{
+  std::vector<cfdScenario> scenarios;
+
+  // what main() paints right after the first update
+  cfdScenario startup = makeScenario("startup", 128, 128, 3, 1, 96);
+  startup.dabs.push_back(makeDab(1, SCENARIO_SOURCE, 64, 64));
+  const int pushes[][2] = { {60, 60}, {30, 30}, {70, 70}, {100, 100}, {64, 64}, {64, 64}, {64, 64}, {64, 64} };
+  for (int k = 0; k < 8; ++k)
+    startup.dabs.push_back(makeDab(1, SCENARIO_DIVERGENCE_NEGATIVE, pushes[k][0], pushes[k][1]));
+  scenarios.push_back(startup);
+
+  // color pushed around a row of obstacles, more pressure iterations
+  cfdScenario obstacles = makeScenario("obstacles", 192, 128, 10, 2, 96);
+  for (int x = 40; x < 192; x += 30)
+    obstacles.dabs.push_back(makeDab(0, SCENARIO_OBSTRUCTION, x, 64));
+  for (int step = 0; step < 48; step += 4)
+  {
+    obstacles.dabs.push_back(makeDab(step, SCENARIO_SOURCE, 12, 58 + step % 12));
+    obstacles.dabs.push_back(makeDab(step, SCENARIO_DIVERGENCE_POSITIVE, 8, 64));
+    obstacles.dabs.push_back(makeDab(step, SCENARIO_DIVERGENCE_NEGATIVE, 180, 64));
+  }
+  scenarios.push_back(obstacles);
+
+  scenarios.push_back(randomScenario("random", 256, 256, 64, 1234));
+
+  // sizes that are not a multiple of any tile or vector width
+  cfdScenario odd = randomScenario("odd", 97, 61, 48, 99);
+  odd.oploops = 2;
+  scenarios.push_back(odd);
+
+  return scenarios;
+}
+
+
+cfdScenario randomScenario(const std::string& name, int nx, int ny, int steps, unsigned int seed)
+{
+  cfdScenario s = makeScenario(name, nx, ny, 6, 1, steps);
+
+  // the same small generator as cfd_bench, so runs repeat on every platform
+  unsigned int state = seed;
+  const int ndabs = steps * 2;
+  for (int d = 0; d < ndabs; ++d)
+  {
+    int value[4];
+    for (int v = 0; v < 4; ++v)
+    {
+      state = state * 1664525u + 1013904223u;
+      value[v] = (int) (state >> 8);
+    }
+    // obstructions only early on so they do not wipe out the whole grid
+    const int mode = d < ndabs / 4 ? value[0] % 4 : 1 + value[0] % 3;
+    s.dabs.push_back(makeDab(value[1] % steps, mode, value[2] % nx, value[3] % ny));
+  }
+  return s;
+}
+
+
+cfdScenario resizeScenario(const cfdScenario& scenario, int nx, int ny)
+{
+  cfdScenario resized = scenario;
+  resized.nx = nx;
+  resized.ny = ny;
+  for (size_t d = 0; d < resized.dabs.size(); ++d)
+  {
+    resized.dabs[d].x = (int) ((long) scenario.dabs[d].x * nx / scenario.nx);
+    resized.dabs[d].y = (int) ((long) scenario.dabs[d].y * ny / scenario.ny);
+  }
+  return resized;
+}
+
+
+scenarioSources::scenarioSources(int nx, int ny, int brushSize)
+{
+  Nx = nx;
+  Ny = ny;
+  brush_size = brushSize;
+  color.assign((size_t) Nx*Ny*3, 0.0f);
+  density.assign((size_t) Nx*Ny, 0.0f);
+  obstruction.assign((size_t) Nx*Ny, 1.0f);
+  divergence.assign((size_t) Nx*Ny, 0.0f);
+  for (int m = 0; m < 4; ++m) { painted[m] = false; }
+}
+
+
+void scenarioSources::dab(int mode, int x, int y)
+{
+  const float divergence_source_magnitude = 250.0f;
+  const brushKernel& source_brush = getBrushKernel(brush_size, BRUSH_FALLOFF_SOURCE);
+  const brushKernel& obstruction_brush = getBrushKernel(brush_size, BRUSH_FALLOFF_OBSTRUCTION);
+
+  // y is in window coordinates, rows of the fields start at the bottom
+  const int row = Ny - y - 1;
+
+  if (mode == SCENARIO_OBSTRUCTION)
+    stampMultiply(&obstruction[0], Nx, Ny, x, row, obstruction_brush);
+  else if (mode == SCENARIO_SOURCE)
+  {
+    stampAddRGB(&color[0], Nx, Ny, x, row, source_brush, 1.0f);
+    stampAdd(&density[0], Nx, Ny, x, row, source_brush, 1.0f);
+  }
+  else if (mode == SCENARIO_DIVERGENCE_POSITIVE)
+    stampAdd(&divergence[0], Nx, Ny, x, row, source_brush, divergence_source_magnitude);
+  else if (mode == SCENARIO_DIVERGENCE_NEGATIVE)
+    stampAdd(&divergence[0], Nx, Ny, x, row, source_brush, -divergence_source_magnitude);
+  painted[mode] = true;
+}
@@ -0,0 +1,93 @@
+//
+// Seeded, repeatable solver scenarios: a grid, solver settings and a list
+// of paint dabs applied at given steps. Any solver with the cfd interface
+// (cfd, cfdReference) can be driven through one, so runs can be compared
+// field for field.
+//
+
+#ifndef CFDSCENARIO_H
+#define CFDSCENARIO_H
+
+#include <string>
+#include <vector>
+
+enum scenarioPaint { SCENARIO_OBSTRUCTION, SCENARIO_SOURCE, SCENARIO_DIVERGENCE_POSITIVE, SCENARIO_DIVERGENCE_NEGATIVE };
+
+// a dab of paint centered on (x, y) in window coordinates, y down, as the
+// simulator receives it, applied before step 'step' is taken
+struct scenarioDab
+{
+  int step;
+  int mode;
+  int x, y;
+};
+
+struct cfdScenario
+{
+  std::string name;
+  int    nx, ny;
+  int    nloops, oploops;
+  float  dt;
+  int    steps;
+  int    brushSize;
+  std::vector<scenarioDab> dabs;
+};
+
+// The startup of fluid_simulator (one color source and a stack of negative
+// divergence dabs), an obstacle course, seeded random painting over time
+// and an odd sized grid that exercises the edges.
+std::vector<cfdScenario> defaultScenarios();
+
+// dabs of every kind at seeded random places and steps
+cfdScenario randomScenario(const std::string& name, int nx, int ny, int steps, unsigned int seed);
+
+// the same scenario on another grid, dabs moved to the same relative places
+cfdScenario resizeScenario(const cfdScenario& scenario, int nx, int ny);
+
+
+// Source fields for one solver, filled the way the simulator paints them.
+class scenarioSources
+{
+  public:
+    scenarioSources(int nx, int ny, int brushSize);
+
+    // paint every dab of this step into the sources and hand them to the solver
+    template <class Solver>
+    void apply(const cfdScenario& scenario, int step, Solver& solver);
+
+  private:
+    int   Nx, Ny;
+    int   brush_size;
+    std::vector<float> color, density, obstruction, divergence;
+
+    void dab(int mode, int x, int y);
+    bool painted[4]; // per scenarioPaint, since the last apply
+};
+
+
+template <class Solver>
+void scenarioSources::apply(const cfdScenario& scenario, int step, Solver& solver)
+{
+  for (int m = 0; m < 4; ++m) { painted[m] = false; }
+  for (size_t d = 0; d < scenario.dabs.size(); ++d)
+  {
+    if (scenario.dabs[d].step == step)
+      dab(scenario.dabs[d].mode, scenario.dabs[d].x, scenario.dabs[d].y);
+  }
+
+  // same pairing of source fields as DabSomePaint
+  if (painted[SCENARIO_OBSTRUCTION])
+    solver.setObstructionSourceField(&obstruction[0]);
+  if (painted[SCENARIO_SOURCE])
+  {
+    solver.setColorSourceField(&color[0]);
+    solver.setDensitySourceField(&density[0]);
+  }
+  if (painted[SCENARIO_DIVERGENCE_POSITIVE] || painted[SCENARIO_DIVERGENCE_NEGATIVE])
+  {
+    solver.setColorSourceField(&color[0]);
+    solver.setDivergenceSourceField(&divergence[0]);
+  }
+}
+
+#endif //CFDSCENARIO_H
@@ -0,0 +1,308 @@
+//
+// Start-up autotuning of the solver settings that only change speed.
+//
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "cfd.h"
+#include "cfdKernels.h"
+#include "cfdTuning.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+
+namespace
+{
+
+// one line of the tuning file
+struct tuningEntry
+{
+  std::string model;
+  int         nx, ny, nloops, oploops;
+  cfdTuning   tuning;
+};
+
+
+bool parseEntry(const std::string& line, tuningEntry& entry)
+{
+  if (line.empty() || line[0] == '#')
+    return false;
+
+  std::vector<std::string> fields;
+  std::stringstream in(line);
+  std::string field;
+  while (std::getline(in, field, '\t')) { fields.push_back(field); }
+  if (fields.size() != 9)
+    return false;
+
+  entry.model = fields[0];
+  entry.nx = atoi(fields[1].c_str());
+  entry.ny = atoi(fields[2].c_str());
+  entry.nloops = atoi(fields[3].c_str());
+  entry.oploops = atoi(fields[4].c_str());
+  entry.tuning.kernels = fields[5];
+  entry.tuning.tileSize = atoi(fields[6].c_str());
+  entry.tuning.threads = atoi(fields[7].c_str());
+  entry.tuning.secondsPerStep = atof(fields[8].c_str());
+  return true;
+}
+
+
+bool sameKey(const tuningEntry& entry, const std::string& model, int nx, int ny, int nloops, int oploops)
+{
+  return entry.model == model && entry.nx == nx && entry.ny == ny &&
+         entry.nloops == nloops && entry.oploops == oploops;
+}
+
+
+// Best of 'steps' timed steps of a grid with a source and sink pair
+// driving the flow, after one step to fault in pages and start the team.
+double timeSteps(int nx, int ny, int nloops, int oploops, const threadConfig& config, int threads,
+                 const char* kernels, int tileSize, int steps)
+{
+  threadConfig trial = config;
+  trial.threads = threads;
+  applyThreadConfig(trial);
+
+  cfd solver(nx, ny, 1.0f, 1.0f/24.0f, nloops, oploops);
+  solver.setKernelVariant(kernels);
+  solver.setTileSize(tileSize);
+
+  std::vector<float> color((size_t) nx*ny*3), divergence((size_t) nx*ny, 0.0f);
+  const int radius = (ny < nx ? ny : nx) / 8 + 1;
+  for (int j = 0; j < ny; ++j)
+  {
+    for (int i = 0; i < nx; ++i)
+    {
+      const int k = i + nx*j;
+      color[3*k] = (j / 8) % 2 ? 1.0f : 0.0f;
+      color[3*k+1] = (i / 8) % 2 ? 1.0f : 0.0f;
+      color[3*k+2] = 0.5f;
+
+      const int dy = j - ny/2, dxa = i - nx/3, dxb = i - 2*nx/3;
+      if (dxa*dxa + dy*dy < radius*radius) { divergence[k] = 1.0f; }
+      if (dxb*dxb + dy*dy < radius*radius) { divergence[k] = -1.0f; }
+    }
+  }
+  solver.setColorSourceField(&color[0]);
+  solver.setDivergenceSourceField(&divergence[0]);
+  solver.step();
+
+  double best = 1e30;
+  for (int s = 0; s < steps; ++s)
+  {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    solver.step();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+} // namespace
+
+
+std::string cpuModelName()
+{
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line))
+  {
+    if (line.compare(0, 10, "model name") != 0)
+      continue;
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      break;
+    std::string model = line.substr(colon + 1);
+    model.erase(0, model.find_first_not_of(" \t"));
+    for (size_t k = 0; k < model.size(); ++k)
+    {
+      if (model[k] == '\t')
+        model[k] = ' ';
+    }
+    return model.empty() ? "unknown" : model;
+  }
+  return "unknown";
+}
+
+
+int loadTuning(const std::string& path, int nx, int ny, int nloops, int oploops, cfdTuning& tuning)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+    return -1;
+
+  const std::string model = cpuModelName();
+  std::string line;
+  tuningEntry entry;
+  while (std::getline(in, line))
+  {
+    if (parseEntry(line, entry) && sameKey(entry, model, nx, ny, nloops, oploops))
+    {
+      tuning = entry.tuning;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+int saveTuning(const std::string& path, int nx, int ny, int nloops, int oploops, const cfdTuning& tuning)
+{
+  const std::string model = cpuModelName();
+
+  // keep every other entry, drop the one being replaced
+  std::vector<std::string> lines;
+  {
+    std::ifstream in(path.c_str());
+    std::string line;
+    tuningEntry entry;
+    while (std::getline(in, line))
+    {
+      if (line.empty() || line[0] == '#')
+        continue;
+      if (!parseEntry(line, entry) || !sameKey(entry, model, nx, ny, nloops, oploops))
+        lines.push_back(line);
+    }
+  }
+
+  const std::string temp = path + ".tmp";
+  FILE* fp = fopen(temp.c_str(), "w");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "Error: cannot write %s\n", temp.c_str());
+    return -1;
+  }
+  fprintf(fp, "# cfd autotuning: cpu model, nx, ny, nloops, oploops, kernels, tile size, threads, seconds per step\n");
+  for (size_t k = 0; k < lines.size(); ++k) { fprintf(fp, "%s\n", lines[k].c_str()); }
+  fprintf(fp, "%s\t%d\t%d\t%d\t%d\t%s\t%d\t%d\t%.6g\n", model.c_str(), nx, ny, nloops, oploops,
+          tuning.kernels.c_str(), tuning.tileSize, tuning.threads, tuning.secondsPerStep);
+  if (fclose(fp) != 0 || rename(temp.c_str(), path.c_str()) != 0)
+  {
+    fprintf(stderr, "Error: cannot write %s\n", path.c_str());
+    remove(temp.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+
+cfdTuning autotune(int nx, int ny, int nloops, int oploops, const threadConfig& config, int steps, FILE* log)
+{
+  if (steps < 1)
+    steps = 1;
+
+  int maxThreads = config.threads;
+#ifdef _OPENMP
+  if (maxThreads <= 0)
+    maxThreads = omp_get_max_threads();
+#else
+  maxThreads = 1;
+#endif
+
+  cfdTuning best;
+  best.kernels = cfdKernels().name;
+  best.tileSize = 32;
+  best.threads = maxThreads;
+  best.secondsPerStep = 1e30;
+
+  // threads: powers of two and the maximum
+  std::vector<int> threads;
+  for (int t = 1; t < maxThreads; t *= 2) { threads.push_back(t); }
+  threads.push_back(maxThreads);
+  for (size_t k = 0; k < threads.size(); ++k)
+  {
+    const double seconds = timeSteps(nx, ny, nloops, oploops, config, threads[k], best.kernels.c_str(),
+                                     best.tileSize, steps);
+    if (log != NULL)
+      fprintf(log, "autotune %dx%d: %d threads %.3f ms/step\n", nx, ny, threads[k], seconds * 1e3);
+    if (seconds < best.secondsPerStep)
+    {
+      best.secondsPerStep = seconds;
+      best.threads = threads[k];
+    }
+  }
+
+  // kernel variants, unless CFD_ISA forces one
+  const char* forced = getenv("CFD_ISA");
+  if (forced == NULL || forced[0] == '\0')
+  {
+    const char* variants[] = { "generic", "sse4.2", "avx2", "avx512" };
+    for (int k = 0; k < 4; ++k)
+    {
+      if (cfdKernelVariant(variants[k]) == 0 || best.kernels == variants[k])
+        continue;
+      const double seconds = timeSteps(nx, ny, nloops, oploops, config, best.threads, variants[k],
+                                       best.tileSize, steps);
+      if (log != NULL)
+        fprintf(log, "autotune %dx%d: %s kernels %.3f ms/step\n", nx, ny, variants[k], seconds * 1e3);
+      if (seconds < best.secondsPerStep)
+      {
+        best.secondsPerStep = seconds;
+        best.kernels = variants[k];
+      }
+    }
+  }
+
+  // tile sizes
+  const int tiles[] = { 16, 64, 128 };
+  for (int k = 0; k < 3; ++k)
+  {
+    const double seconds = timeSteps(nx, ny, nloops, oploops, config, best.threads, best.kernels.c_str(),
+                                     tiles[k], steps);
+    if (log != NULL)
+      fprintf(log, "autotune %dx%d: tile %d %.3f ms/step\n", nx, ny, tiles[k], seconds * 1e3);
+    if (seconds < best.secondsPerStep)
+    {
+      best.secondsPerStep = seconds;
+      best.tileSize = tiles[k];
+    }
+  }
+
+  if (log != NULL)
+    fprintf(log, "autotune %dx%d: picked %s kernels, tile %d, %d threads (%.3f ms/step)\n", nx, ny,
+            best.kernels.c_str(), best.tileSize, best.threads, best.secondsPerStep * 1e3);
+  return best;
+}
+
+
+cfdTuning findTuning(const std::string& path, int nx, int ny, int nloops, int oploops,
+                     const threadConfig& config, int steps, FILE* log)
+{
+  cfdTuning tuning;
+  if (loadTuning(path, nx, ny, nloops, oploops, tuning) == 0 && cfdKernelVariant(tuning.kernels.c_str()) != 0)
+  {
+    if (log != NULL)
+      fprintf(log, "autotune %dx%d: using %s kernels, tile %d, %d threads from %s\n", nx, ny,
+              tuning.kernels.c_str(), tuning.tileSize, tuning.threads, path.c_str());
+    return tuning;
+  }
+
+  tuning = autotune(nx, ny, nloops, oploops, config, steps, log);
+  saveTuning(path, nx, ny, nloops, oploops, tuning);
+  return tuning;
+}
+
+
+int applyTuning(cfd& solver, const cfdTuning& tuning)
+{
+  int result = 0;
+  const char* forced = getenv("CFD_ISA");
+  if ((forced == NULL || forced[0] == '\0') && solver.setKernelVariant(tuning.kernels.c_str()) != 0)
+  {
+    fprintf(stderr, "Warning: kernel variant %s is not available here\n", tuning.kernels.c_str());
+    result = -1;
+  }
+  if (solver.setTileSize(tuning.tileSize) != 0)
+  {
+    fprintf(stderr, "Warning: tile size %d is not a power of two from 8 to 256\n", tuning.tileSize);
+    result = -1;
+  }
+  return result;
+}
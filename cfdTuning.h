@@ -0,0 +1,54 @@
+//
+// Start-up autotuning of the solver settings that only change speed: the
+// kernel variant, the tile size and the thread count. A few calibration
+// steps are timed for each candidate and the fastest settings are kept in
+// a small text file keyed by CPU model, grid size and loop counts, so later
+// runs on the same host start with them right away.
+//
+// The search goes one setting at a time (threads, then kernels, then
+// tiles) rather than over every combination, which keeps calibration to
+// a few dozen steps.
+//
+
+#ifndef CFDTUNING_H
+#define CFDTUNING_H
+
+#include <cstdio>
+#include <string>
+#include "threadConfig.h"
+
+class cfd;
+
+struct cfdTuning
+{
+  std::string kernels;        // kernel variant name, see cfdKernels.h
+  int         tileSize;
+  int         threads;
+  double      secondsPerStep; // as measured when tuned
+};
+
+// "model name" from /proc/cpuinfo, or "unknown"
+std::string cpuModelName();
+
+// returns 0 and fills tuning if path has an entry for this host and grid
+int loadTuning(const std::string& path, int nx, int ny, int nloops, int oploops, cfdTuning& tuning);
+
+// adds or replaces the entry for this host and grid. returns 0 on success
+int saveTuning(const std::string& path, int nx, int ny, int nloops, int oploops, const cfdTuning& tuning);
+
+// Times 'steps' steps of each candidate, on teams of up to config.threads
+// threads (0: the OpenMP default) placed with config.binding. Progress goes
+// to log unless it is NULL. The calling thread's team is left at the size
+// of the last candidate, so apply the chosen config afterwards.
+cfdTuning autotune(int nx, int ny, int nloops, int oploops, const threadConfig& config, int steps, FILE* log);
+
+// the cached tuning if there is one, otherwise autotune and save it
+cfdTuning findTuning(const std::string& path, int nx, int ny, int nloops, int oploops,
+                     const threadConfig& config, int steps, FILE* log);
+
+// kernel variant (unless CFD_ISA forces one) and tile size; the thread
+// count goes in the threadConfig before the cfd is constructed. returns 0,
+// or -1 if a setting is refused
+int applyTuning(cfd& solver, const cfdTuning& tuning);
+
+#endif //CFDTUNING_H
@@ -5,7 +5,7 @@
 #ifndef ADVECTION_CFDUTILITY_H
 #define ADVECTION_CFDUTILITY_H
 
-void swapFloatPointers(float** a, float** b)
+inline void swapFloatPointers(float** a, float** b)
 {
   float* temp = *a;
   *a = *b;
@@ -13,7 +13,7 @@ void swapFloatPointers(float** a, float** b)
 }
 
 
-void Initialize( float *data, int size, float value )
+inline void Initialize( float *data, int size, float value )
 {
 #ifdef __linux__
 #pragma omp parallel for
@@ -22,4 +22,16 @@ void Initialize( float *data, int size, float value )
 }
 
 
+// Rows [begin, end) of part out of parts, split in whole blocks of rows so
+// that no two parts share a block.
+inline void rowPartition(int rows, int block, int part, int parts, int* begin, int* end)
+{
+  const long long blocks = (rows + block - 1) / block;
+  const int first = (int) (blocks * part / parts) * block;
+  const int last = (int) (blocks * (part+1) / parts) * block;
+  *begin = first < rows ? first : rows;
+  *end = last < rows ? last : rows;
+}
+
+
 #endif //ADVECTION_CFDUTILITY_H
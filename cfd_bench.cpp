@@ -0,0 +1,394 @@
+//------------------------------------------------
+//
+//  Program: cfd_bench
+//
+//  Times the individual passes of the cfd solver in
+//  isolation over a sweep of grid sizes, thread
+//  counts and obstruction densities.
+//
+//  usage:
+//
+//  cfd_bench [-size N]... [-threads T]... [-obstruction F]...
+//            [-min_time seconds] [-json results.json]
+//            [-trace trace.json] [-perf 1]
+//            [-bind none|close|spread] [-bandwidth_mb MB]
+//            [-skip_solids 1]
+//
+//  -size, -threads and -obstruction may be given
+//  several times; every combination is run. For each
+//  pass it reports ns per cell and the achieved
+//  bandwidth, counting only the compulsory memory
+//  traffic of the pass (each field read or written
+//  once per cell). With -perf 1 and a CFD_PERF build
+//  it adds IPC and cache/branch misses per cell from
+//  the hardware counters; these count the main thread
+//  only, so use -threads 1 for whole-pass numbers.
+//
+//  The grid is allocated again for every thread count
+//  so that it is first touched by the team that runs
+//  it. -bind pins that team (see threadConfig.h), and
+//  -bandwidth_mb measures the triad bandwidth of each
+//  NUMA node first, with that many MB per thread at
+//  the largest thread count. -skip_solids 1 takes the
+//  solid cells out of the pressure passes.
+//
+//-------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "CmdLineFind.h"
+#include "cfd.h"
+#include "cfdKernels.h"
+#include "displayConvert.h"
+#include "perfCounters.h"
+#include "phaseTimer.h"
+#include "threadConfig.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+using namespace std;
+using namespace lux;
+
+
+// small deterministic generator so every run sees the same fields
+struct benchRandom
+{
+  unsigned int state;
+  benchRandom(unsigned int seed) : state(seed) {}
+  float next() { state = state * 1664525u + 1013904223u; return (state >> 8) * (1.0f / 16777216.0f); }
+};
+
+
+class cfdBench
+{
+  public:
+    cfdBench(int n, float obstruction_density, int nloops, bool skip_solids);
+    ~cfdBench();
+
+    // one call of the named pass. returns false for an unknown name
+    bool run(const string& pass);
+
+    // bytes of compulsory traffic per cell for a pass
+    double bytesPerCell(const string& pass) const;
+
+    long cells() const { return (long) N * N; }
+
+  private:
+    int   N;
+    int   nloops;
+    cfd   *fluid;
+    vector<float> color_source, density_source, obstruction_source;
+    vector<unsigned char> display;
+};
+
+
+cfdBench::cfdBench(int n, float obstruction_density, int Nloops, bool skip_solids)
+{
+  N = n;
+  nloops = Nloops;
+  fluid = new cfd(N, N, 1.0, (float)(1.0/24.0), nloops, 1);
+  benchRandom random(1234);
+
+  // a swirling velocity field, so advection gathers from all directions
+  for (int j = 0; j < N; ++j)
+  {
+    for (int i = 0; i < N; ++i)
+    {
+      const float x = (float) i / N - 0.5f, y = (float) j / N - 0.5f;
+      fluid->velocity1[fluid->vIndex(i,j,0)] = -y * N * 2.0f + (random.next() - 0.5f);
+      fluid->velocity1[fluid->vIndex(i,j,1)] =  x * N * 2.0f + (random.next() - 0.5f);
+      fluid->density1[fluid->dIndex(i,j)] = random.next();
+      for (int c = 0; c < 3; ++c) { fluid->color1[fluid->cIndex(i,j,c)] = random.next(); }
+    }
+  }
+
+  // solid discs until the requested fraction of cells is covered
+  const int radius = N / 32 > 1 ? N / 32 : 1;
+  long solid = 0;
+  while (solid < obstruction_density * cells())
+  {
+    const int cx = (int) (random.next() * N), cy = (int) (random.next() * N);
+    for (int j = cy - radius; j <= cy + radius; ++j)
+    {
+      for (int i = cx - radius; i <= cx + radius; ++i)
+      {
+        if (i < 0 || j < 0 || i >= N || j >= N) { continue; }
+        if ((i-cx)*(i-cx) + (j-cy)*(j-cy) > radius*radius) { continue; }
+        float& o = fluid->obstruction[fluid->oIndex(i,j)];
+        if (o != 0.0f) { o = 0.0f; ++solid; }
+      }
+    }
+  }
+
+  fluid->setSkipSolids(skip_solids); // also picks up the discs
+
+  color_source.assign((size_t) cells()*3, 0.01f);
+  density_source.assign((size_t) cells(), 0.01f);
+  obstruction_source.assign((size_t) cells(), 1.0f);
+  display.resize((size_t) cells()*3);
+}
+
+
+cfdBench::~cfdBench()
+{
+  delete fluid;
+}
+
+
+bool cfdBench::run(const string& pass)
+{
+  if (pass == "advect")
+    fluid->advect();
+  else if (pass == "computeDivergence")
+    fluid->computeDivergence();
+  else if (pass == "computePressure")
+    fluid->computePressure();
+  else if (pass == "computeVelocityBasedOnPressureForces")
+    fluid->computeVelocityBasedOnPressureForces();
+  else if (pass == "computeObstructedFields")
+    fluid->computeObstructedFields();
+  else if (pass == "computeVelocity")
+    fluid->computeVelocity(0.0f, 0.0f);
+  else if (pass == "addSourceColor")
+  {
+    // the source passes clear their field after use. the fill is timed too,
+    // as it is part of what painting costs
+    fluid->setColorSourceField(&color_source[0]);
+    fluid->addSourceColor();
+  }
+  else if (pass == "addSourceDensity")
+  {
+    fluid->setDensitySourceField(&density_source[0]);
+    fluid->addSourceDensity();
+  }
+  else if (pass == "addSourceObstruction")
+  {
+    fluid->setObstructionSourceField(&obstruction_source[0]);
+    fluid->addSourceObstruction();
+  }
+  else if (pass == "ConvertToDisplay")
+    floatToDisplayBytes(fluid->getColorPointer(), &display[0], (int) cells()*3, 1.0f, 0);
+  else
+    return false;
+  return true;
+}
+
+
+double cfdBench::bytesPerCell(const string& pass) const
+{
+  const double f = sizeof(float);
+  if (pass == "advect")                               return f * (1 + 2 + 3 + 1 + 1 + 2 + 3); // read d,v,c,o; write d,v,c
+  if (pass == "computeDivergence")                    return f * (2 + 1);
+  if (pass == "computePressure")                      return f * (1 + 3 * nloops);          // clear, then p,div in and p out per loop
+  if (pass == "computeVelocityBasedOnPressureForces") return f * (1 + 2 + 2);
+  if (pass == "computeObstructedFields")              return f * (1 + 2 + 2 + 1 + 1);
+  if (pass == "computeVelocity")                      return f * (1 + 2 + 2);
+  if (pass == "addSourceColor")                       return f * (3 + 3 + 1 + 3 + 3);       // includes clearing the source
+  if (pass == "addSourceDensity")                     return f * (1 + 1 + 1 + 1 + 1);
+  if (pass == "addSourceObstruction")                 return f * (1 + 1 + 1 + 3 + 3 + 1);
+  if (pass == "ConvertToDisplay")                     return f * 3 + 3;
+  return 0.0;
+}
+
+
+struct benchResult
+{
+  string pass;
+  int    n, threads;
+  float  obstruction;
+  int    calls;
+  double seconds_per_call;
+  double ns_per_cell;
+  double gb_per_s;
+  bool   counted;
+  bool   valid[PERF_COUNTER_COUNT];
+  double ipc;
+  double cache_misses_per_cell;
+  double branch_misses_per_cell;
+};
+
+
+int main(int argc, char** argv)
+{
+  CmdLineFind clf(argc, argv);
+
+  vector<int> sizes = clf.findMultiple("-size", 512, "Grid size N for an N x N grid (repeatable)");
+  vector<int> threads = clf.findMultiple("-threads", 1, "OpenMP thread count (repeatable)");
+  vector<float> densities = clf.findMultiple("-obstruction", 0.0f, "Fraction of solid cells (repeatable)");
+  vector<string> passes = clf.findMultiple("-pass", string(""), "Only time this pass (repeatable)");
+  float min_time = clf.find("-min_time", 0.2f, "Minimum seconds spent timing each pass");
+  int nloops = clf.find("-nloops", 3, "Number of loops over pressure.");
+  string json_path = clf.find("-json", "", "Write results to this JSON file");
+  string trace_path = clf.find("-trace", "", "Write a Chrome trace of the run to this file (needs CFD_TRACE)");
+  bool perf = clf.find("-perf", 0, "Read hardware counters per pass (needs CFD_PERF, counts the calling thread only)") != 0;
+  string bind = clf.find("-bind", "", "Pin threads: none, close or spread (default CFD_BIND or none)");
+  int bandwidth_mb = clf.find("-bandwidth_mb", 0, "Measure per NUMA node bandwidth with this many MB per thread (0 skips)");
+  bool skip_solids = clf.find("-skip_solids", 0, "Leave solid cells out of the pressure passes") != 0;
+
+  clf.usage("-h");
+  clf.printFinds();
+
+  if (sizes.empty())
+  {
+    for (int n = 128; n <= 4096; n *= 2) { sizes.push_back(n); }
+  }
+  if (threads.empty())
+  {
+#ifdef _OPENMP
+    for (int t = 1; t <= omp_get_max_threads(); t *= 2) { threads.push_back(t); }
+#else
+    threads.push_back(1);
+#endif
+  }
+  if (densities.empty())
+  {
+    densities.push_back(0.0f);
+    densities.push_back(0.25f);
+    densities.push_back(0.5f);
+  }
+  if (passes.empty())
+  {
+    const char* all[] = { "advect", "computeDivergence", "computePressure",
+                          "computeVelocityBasedOnPressureForces", "computeObstructedFields",
+                          "computeVelocity", "addSourceColor", "addSourceDensity",
+                          "addSourceObstruction", "ConvertToDisplay" };
+    passes.assign(all, all + sizeof(all)/sizeof(all[0]));
+  }
+
+  threadConfig config;
+  if (makeThreadConfig(0, bind, config) != 0)
+    return -1;
+
+  vector<double> node_gbps;
+  if (bandwidth_mb > 0)
+  {
+    config.threads = *max_element(threads.begin(), threads.end());
+    applyThreadConfig(config);
+    printThreadPlacement(stdout);
+    measureNodeBandwidth(node_gbps, (size_t) bandwidth_mb * 1024 * 1024 / (3 * sizeof(float)));
+    for (size_t n = 0; n < node_gbps.size(); ++n) { printf("node %d triad bandwidth: %.2f GB/s\n", (int) n, node_gbps[n]); }
+  }
+
+  setTraceThreadName("bench");
+  setTraceEnabled(!trace_path.empty());
+  setPerfEnabled(perf);
+  perf = perf && perfCountersAvailable();
+
+  vector<benchResult> results;
+  printf("kernels: %s\n", cfdKernels().name);
+  printf("%-38s %6s %7s %6s %8s %12s %10s", "pass", "N", "threads", "obst", "calls", "ns/cell", "GB/s");
+  if (perf) { printf(" %6s %12s %12s", "IPC", "cmiss/cell", "bmiss/cell"); }
+  printf("\n");
+
+  for (size_t si = 0; si < sizes.size(); ++si)
+  {
+    for (size_t di = 0; di < densities.size(); ++di)
+    {
+      for (size_t ti = 0; ti < threads.size(); ++ti)
+      {
+        config.threads = threads[ti];
+        applyThreadConfig(config);
+        cfdBench bench(sizes[si], densities[di], nloops, skip_solids);
+
+        for (size_t pi = 0; pi < passes.size(); ++pi)
+        {
+          if (!bench.run(passes[pi])) // warm up caches, pages and the thread pool
+          {
+            fprintf(stderr, "Error: unknown pass %s\n", passes[pi].c_str());
+            return -1;
+          }
+
+          perfReset();
+          int calls = 0;
+          std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+          double elapsed = 0.0;
+          do
+          {
+            {
+              CFD_PERF_SCOPE("bench pass");
+              bench.run(passes[pi]);
+            }
+            ++calls;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          } while (elapsed < min_time || calls < 3);
+
+          benchResult r;
+          r.pass = passes[pi];
+          r.n = sizes[si];
+          r.threads = threads[ti];
+          r.obstruction = densities[di];
+          r.calls = calls;
+          r.seconds_per_call = elapsed / calls;
+          r.ns_per_cell = r.seconds_per_call * 1e9 / bench.cells();
+          r.gb_per_s = bench.bytesPerCell(r.pass) * bench.cells() / r.seconds_per_call * 1e-9;
+
+          const perfTotals counters = perfPhaseTotals("bench pass");
+          const double counted_cells = (double) bench.cells() * counters.calls;
+          r.counted = perf && counters.calls > 0;
+          for (int c = 0; c < PERF_COUNTER_COUNT; ++c) { r.valid[c] = counters.valid[c]; }
+          r.ipc = counters.value[PERF_CYCLES] > 0.0 ? counters.value[PERF_INSTRUCTIONS] / counters.value[PERF_CYCLES] : 0.0;
+          r.cache_misses_per_cell = r.counted ? counters.value[PERF_CACHE_MISSES] / counted_cells : 0.0;
+          r.branch_misses_per_cell = r.counted ? counters.value[PERF_BRANCH_MISSES] / counted_cells : 0.0;
+          results.push_back(r);
+
+          printf("%-38s %6d %7d %6.2f %8d %12.3f %10.2f", r.pass.c_str(), r.n, r.threads,
+                 r.obstruction, r.calls, r.ns_per_cell, r.gb_per_s);
+          if (r.counted)
+          {
+            // counters the host does not have are shown as -
+            if (r.valid[PERF_CYCLES] && r.valid[PERF_INSTRUCTIONS]) printf(" %6.2f", r.ipc); else printf(" %6s", "-");
+            if (r.valid[PERF_CACHE_MISSES]) printf(" %12.4f", r.cache_misses_per_cell); else printf(" %12s", "-");
+            if (r.valid[PERF_BRANCH_MISSES]) printf(" %12.4f", r.branch_misses_per_cell); else printf(" %12s", "-");
+          }
+          printf("\n");
+          fflush(stdout);
+        }
+      }
+    }
+  }
+
+  if (!json_path.empty())
+  {
+    FILE *fp = fopen(json_path.c_str(), "w");
+    if (fp == NULL)
+    {
+      fprintf(stderr, "Error: cannot write %s\n", json_path.c_str());
+      return -1;
+    }
+    fprintf(fp, "{\n  \"benchmark\": \"cfd_bench\",\n  \"kernels\": \"%s\",\n  \"binding\": \"%s\",\n  \"nloops\": %d,\n"
+                "  \"skip_solids\": %s,\n",
+            cfdKernels().name, threadBindingName(config.binding), nloops, skip_solids ? "true" : "false");
+    if (!node_gbps.empty())
+    {
+      fprintf(fp, "  \"node_bandwidth_gb_per_s\": [");
+      for (size_t n = 0; n < node_gbps.size(); ++n) { fprintf(fp, "%s%.4g", n ? ", " : "", node_gbps[n]); }
+      fprintf(fp, "],\n");
+    }
+    fprintf(fp, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const benchResult& r = results[i];
+      fprintf(fp, "    {\"pass\": \"%s\", \"n\": %d, \"threads\": %d, \"obstruction\": %g, "
+                  "\"calls\": %d, \"seconds_per_call\": %.9g, \"ns_per_cell\": %.6g, \"gb_per_s\": %.6g",
+              r.pass.c_str(), r.n, r.threads, r.obstruction, r.calls, r.seconds_per_call,
+              r.ns_per_cell, r.gb_per_s);
+      if (r.counted && r.valid[PERF_CYCLES] && r.valid[PERF_INSTRUCTIONS])
+        fprintf(fp, ", \"ipc\": %.4g", r.ipc);
+      if (r.counted && r.valid[PERF_CACHE_MISSES])
+        fprintf(fp, ", \"cache_misses_per_cell\": %.6g", r.cache_misses_per_cell);
+      if (r.counted && r.valid[PERF_BRANCH_MISSES])
+        fprintf(fp, ", \"branch_misses_per_cell\": %.6g", r.branch_misses_per_cell);
+      fprintf(fp, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+  }
+
+  if (!trace_path.empty() && writeTrace(trace_path.c_str()) != 0)
+    return -1;
+  return 0;
+}
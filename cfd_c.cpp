@@ -0,0 +1,72 @@
+//
+// C interface to the cfd solver.
+//
+#include <new>
+#include "cfd.h"
+#include "cfd_c.h"
+
+// the handle is the solver itself, only the name is opaque to C
+struct cfd_solver : public cfd
+{
+  cfd_solver(int nx, int ny, float dx, float dt, int nloops, int oploops, const cfdBuffers& buffers,
+             unsigned fields, unsigned transported) :
+    cfd(nx, ny, dx, dt, nloops, oploops, buffers, fields, transported) {}
+};
+
+
+cfd_solver* cfd_create(int nx, int ny, float dx, float dt, int nloops, int oploops,
+                       const cfd_buffers* buffers)
+{
+  return cfd_create_fields(nx, ny, dx, dt, nloops, oploops, buffers, CFD_FIELD_ALL, CFD_FIELD_ALL);
+}
+
+
+cfd_solver* cfd_create_fields(int nx, int ny, float dx, float dt, int nloops, int oploops,
+                              const cfd_buffers* buffers, unsigned fields, unsigned transported)
+{
+  if (nx < 1 || ny < 1) { return 0; }
+
+  cfdBuffers storage = cfdBuffers();
+  if (buffers != 0)
+  {
+    for (int k = 0; k < 2; ++k)
+    {
+      storage.density[k] = buffers->density[k];
+      storage.velocity[k] = buffers->velocity[k];
+      storage.color[k] = buffers->color[k];
+    }
+    storage.divergence = buffers->divergence;
+    storage.pressure = buffers->pressure;
+    storage.obstruction = buffers->obstruction;
+  }
+
+  // exceptions must not cross into C
+  try
+  {
+    return new cfd_solver(nx, ny, dx, dt, nloops, oploops, storage, fields, transported);
+  }
+  catch (const std::bad_alloc&)
+  {
+    return 0;
+  }
+}
+
+
+void cfd_destroy(cfd_solver* solver)                           { delete solver; }
+void cfd_step(cfd_solver* solver)                              { solver->step(); }
+void cfd_advect(cfd_solver* solver)                            { solver->advect(); }
+void cfd_sources(cfd_solver* solver)                           { solver->sources(); }
+
+void cfd_set_density_source(cfd_solver* solver, float* field)     { solver->setDensitySourceField(field); }
+void cfd_set_color_source(cfd_solver* solver, float* field)       { solver->setColorSourceField(field); }
+void cfd_set_obstruction_source(cfd_solver* solver, float* field) { solver->setObstructionSourceField(field); }
+void cfd_set_divergence_source(cfd_solver* solver, float* field)  { solver->setDivergenceSourceField(field); }
+
+int cfd_width(const cfd_solver* solver)                        { return solver->getNx(); }
+int cfd_height(const cfd_solver* solver)                       { return solver->getNy(); }
+float* cfd_density(const cfd_solver* solver)                   { return solver->getDensityPointer(); }
+float* cfd_velocity(const cfd_solver* solver)                  { return solver->getVelocityPointer(); }
+float* cfd_color(const cfd_solver* solver)                     { return solver->getColorPointer(); }
+float* cfd_pressure(const cfd_solver* solver)                  { return solver->getPressurePointer(); }
+float* cfd_divergence(const cfd_solver* solver)                { return solver->getDivergencePointer(); }
+float* cfd_obstruction(const cfd_solver* solver)               { return solver->getObstructionPointer(); }
@@ -0,0 +1,70 @@
+/*
+ * C interface to the cfd solver, for hosts that embed libcfd without C++.
+ * Mirrors the cfd class: see cfd.h for the field layout and for how source
+ * fields are consumed.
+ */
+
+#ifndef CFD_C_H
+#define CFD_C_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cfd_solver cfd_solver;
+
+/* Same meaning as cfdBuffers: arrays owned by the host, 0 to let the
+ * solver allocate that field itself. */
+typedef struct cfd_buffers
+{
+  float *density[2];
+  float *velocity[2];
+  float *color[2];
+  float *divergence;
+  float *pressure;
+  float *obstruction;
+} cfd_buffers;
+
+/* buffers may be NULL. returns NULL if the solver could not be created */
+cfd_solver* cfd_create(int nx, int ny, float dx, float dt, int nloops, int oploops,
+                       const cfd_buffers* buffers);
+
+/* Field registry (cfd::cfdField in cfd.h): the fields to keep and the ones
+ * advect moves. Fields left out are not allocated and read back as NULL. */
+#define CFD_FIELD_DENSITY  1u
+#define CFD_FIELD_VELOCITY 2u
+#define CFD_FIELD_COLOR    4u
+#define CFD_FIELD_ALL      7u
+
+cfd_solver* cfd_create_fields(int nx, int ny, float dx, float dt, int nloops, int oploops,
+                              const cfd_buffers* buffers, unsigned fields, unsigned transported);
+void cfd_destroy(cfd_solver* solver);
+
+/* one full step, or its two halves */
+void cfd_step(cfd_solver* solver);
+void cfd_advect(cfd_solver* solver);
+void cfd_sources(cfd_solver* solver);
+
+/* Source fields are read by the next step and then reset in place (to 0,
+ * or to 1 for obstruction); they stay owned by the host. */
+void cfd_set_density_source(cfd_solver* solver, float* field);
+void cfd_set_color_source(cfd_solver* solver, float* field);
+void cfd_set_obstruction_source(cfd_solver* solver, float* field);
+void cfd_set_divergence_source(cfd_solver* solver, float* field);
+
+/* Current fields, not copied. Density, velocity and color move between
+ * their two buffers every step, so fetch them again after stepping. */
+int cfd_width(const cfd_solver* solver);
+int cfd_height(const cfd_solver* solver);
+float* cfd_density(const cfd_solver* solver);
+float* cfd_velocity(const cfd_solver* solver);
+float* cfd_color(const cfd_solver* solver);
+float* cfd_pressure(const cfd_solver* solver);
+float* cfd_divergence(const cfd_solver* solver);
+float* cfd_obstruction(const cfd_solver* solver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CFD_C_H */
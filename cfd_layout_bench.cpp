@@ -0,0 +1,367 @@
+//------------------------------------------------
+//
+//  Program: cfd_layout_bench
+//
+//  Times one semi-Lagrangian advection step of
+//  velocity and color, the gathers of cfd's advect
+//  pass, with the fields stored row-major, in square
+//  blocks or in Morton (Z) order (see cfdLayout.h),
+//  and walked either a row at a time or a tile at a
+//  time.
+//
+//  usage:
+//
+//  cfd_layout_bench [-size N]... [-shift S]...
+//                   [-layout row-major|blocked|morton]...
+//                   [-order rows|tiles]... [-block B]
+//                   [-tile T] [-threads T]
+//                   [-min_time seconds] [-json results.json]
+//
+//  -shift is the longest backtrace in cells: the
+//  velocity is a vortex that moves the corners of the
+//  grid that far per step. Every combination of size,
+//  shift, layout and order is run and reported in ns
+//  per cell and against row-major rows of the same
+//  size and shift. The "same" column checks that the
+//  step gave bit for bit the row-major result.
+//
+//-------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "CmdLineFind.h"
+#include "cfdLayout.h"
+#include "cfdUtility.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+using namespace std;
+using namespace lux;
+
+
+struct layoutFields
+{
+  fieldLayout   layout;
+  vector<float> velocity, color, obstruction;
+  vector<float> velocity2, color2;
+};
+
+
+// fields stored in layout with a vortex moving the corners shift cells
+// per step, and a checkerboard of color
+void fillFields(layoutFields& f, const fieldLayout& layout, float shift, float dt)
+{
+  f.layout = layout;
+  const size_t cells = layout.cells();
+  f.velocity.assign(cells*2, 0.0f);
+  f.color.assign(cells*3, 0.0f);
+  f.obstruction.assign(cells, 1.0f);
+  f.velocity2.assign(cells*2, 0.0f);
+  f.color2.assign(cells*3, 0.0f);
+
+  const float cx = 0.5f * (layout.Nx - 1), cy = 0.5f * (layout.Ny - 1);
+  const float corner = sqrtf(cx*cx + cy*cy);
+  const float scale = corner > 0.0f ? shift / (corner * dt) : 0.0f;
+  for (int j = 0; j < layout.Ny; ++j)
+  {
+    for (int i = 0; i < layout.Nx; ++i)
+    {
+      const size_t k = layout.index(i, j);
+      f.velocity[2*k] = -(j - cy) * scale;
+      f.velocity[2*k+1] = (i - cx) * scale;
+      for (int c = 0; c < 3; ++c) { f.color[3*k+c] = ((i >> (3+c)) + (j >> 3)) % 2 ? 1.0f : 0.25f; }
+    }
+  }
+}
+
+
+// cell (ii,j) of cfd's advectRow, through the layout's index
+inline void advectCell(layoutFields& f, int ii, int j, float Dx, float dt)
+{
+  const fieldLayout& L = f.layout;
+  const int Nx = L.Nx, Ny = L.Ny;
+  const size_t k = L.index(ii, j);
+  const float o = f.obstruction[k];
+  const float x = ii*Dx - f.velocity[2*k]*dt * o;
+  const float y = j*Dx - f.velocity[2*k+1]*dt * o;
+
+  const int i = (int) (x/Dx);
+  const int jj = (int) (y/Dx);
+  const float ax = std::abs(x/Dx - i);
+  const float ay = std::abs(y/Dx - jj);
+  const float w[4] = { (1-ax) * (1-ay), ax * (1-ay), (1-ax) * ay, ax * ay };
+
+  size_t s[4];
+  bool in[4];
+  for (int n = 0; n < 4; ++n)
+  {
+    const int si = i + (n & 1), sj = jj + (n >> 1);
+    in[n] = si >= 0 && si < Nx && sj >= 0 && sj < Ny;
+    s[n] = in[n] ? L.index(si, sj) : 0;
+  }
+  const int oi = i < 0 ? 0 : (i >= Nx ? Nx-1 : i);
+  const int oj = jj < 0 ? 0 : (jj >= Ny ? Ny-1 : jj);
+  const float so = f.obstruction[L.index(oi, oj)];
+
+  for (int c = 0; c < 2; ++c)
+  {
+    f.velocity2[2*k+c] = (in[0] ? f.velocity[2*s[0]+c] : 0.0f) * w[0] * so +
+                         (in[1] ? f.velocity[2*s[1]+c] : 0.0f) * w[1] * so +
+                         (in[2] ? f.velocity[2*s[2]+c] : 0.0f) * w[2] * so +
+                         (in[3] ? f.velocity[2*s[3]+c] : 0.0f) * w[3] * so;
+  }
+  for (int c = 0; c < 3; ++c)
+  {
+    f.color2[3*k+c] = (in[0] ? f.color[3*s[0]+c] : 0.0f) * w[0] +
+                      (in[1] ? f.color[3*s[1]+c] : 0.0f) * w[1] +
+                      (in[2] ? f.color[3*s[2]+c] : 0.0f) * w[2] +
+                      (in[3] ? f.color[3*s[3]+c] : 0.0f) * w[3];
+  }
+}
+
+
+// one step, the threads splitting the grid in bands of whole tile rows as
+// cfd does. tiles walks each band a tile at a time
+void advectStep(layoutFields& f, bool tiles, int tile, float Dx, float dt)
+{
+  const int Nx = f.layout.Nx, Ny = f.layout.Ny;
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+    int j0, j1;
+#ifdef _OPENMP
+    rowPartition(Ny, tile, omp_get_thread_num(), omp_get_num_threads(), &j0, &j1);
+#else
+    rowPartition(Ny, tile, 0, 1, &j0, &j1);
+#endif
+    if (!tiles)
+    {
+      for (int j = j0; j < j1; ++j)
+      {
+        for (int i = 0; i < Nx; ++i) { advectCell(f, i, j, Dx, dt); }
+      }
+    }
+    else
+    {
+      for (int tj = j0; tj < j1; tj += tile)
+      {
+        const int tj1 = tj + tile < j1 ? tj + tile : j1;
+        for (int ti = 0; ti < Nx; ti += tile)
+        {
+          const int ti1 = ti + tile < Nx ? ti + tile : Nx;
+          for (int j = tj; j < tj1; ++j)
+          {
+            for (int i = ti; i < ti1; ++i) { advectCell(f, i, j, Dx, dt); }
+          }
+        }
+      }
+    }
+  }
+}
+
+
+// the step's output in row-major order, to compare layouts
+void rowMajorOutput(const layoutFields& f, vector<float>& out)
+{
+  const fieldLayout& L = f.layout;
+  out.resize((size_t) L.Nx * L.Ny * 5);
+  for (int j = 0; j < L.Ny; ++j)
+  {
+    for (int i = 0; i < L.Nx; ++i)
+    {
+      const size_t k = L.index(i, j), r = (size_t) i + (size_t) L.Nx * j;
+      for (int c = 0; c < 2; ++c) { out[5*r+c] = f.velocity2[2*k+c]; }
+      for (int c = 0; c < 3; ++c) { out[5*r+2+c] = f.color2[3*k+c]; }
+    }
+  }
+}
+
+
+// best of at least 3 steps and min_time seconds
+double timeSteps(layoutFields& f, bool tiles, int tile, float Dx, float dt, float min_time, int* calls)
+{
+  advectStep(f, tiles, tile, Dx, dt); // warm up pages and the thread pool
+
+  *calls = 0;
+  double best = 1e30, elapsed = 0.0;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  do
+  {
+    const std::chrono::steady_clock::time_point call = std::chrono::steady_clock::now();
+    advectStep(f, tiles, tile, Dx, dt);
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end - call).count());
+    elapsed = std::chrono::duration<double>(end - start).count();
+    ++*calls;
+  } while (elapsed < min_time || *calls < 3);
+  return best;
+}
+
+
+struct layoutResult
+{
+  int    n;
+  float  shift;
+  string layout, order;
+  int    calls;
+  double ns_per_cell;
+  double speedup;
+  bool   same;
+};
+
+
+int main(int argc, char** argv)
+{
+  CmdLineFind clf(argc, argv);
+
+  vector<int> sizes = clf.findMultiple("-size", 2048, "Grid size N for an N x N grid (repeatable)");
+  vector<float> shifts = clf.findMultiple("-shift", 1.0f, "Longest backtrace in cells (repeatable)");
+  vector<string> layouts = clf.findMultiple("-layout", string(""), "row-major, blocked or morton (repeatable)");
+  vector<string> orders = clf.findMultiple("-order", string(""), "rows or tiles (repeatable)");
+  int block = clf.find("-block", 16, "Block edge of the blocked layout, a power of two");
+  int tile = clf.find("-tile", 32, "Tile edge of the tiles order");
+  int threads = clf.find("-threads", 0, "OpenMP thread count (0 keeps the default)");
+  float min_time = clf.find("-min_time", 0.2f, "Minimum seconds spent timing each combination");
+  string json_path = clf.find("-json", "", "Write results to this JSON file");
+
+  clf.usage("-h");
+  clf.printFinds();
+
+  if (sizes.empty())
+  {
+    sizes.push_back(2048);
+    sizes.push_back(4096);
+  }
+  if (shifts.empty())
+  {
+    shifts.push_back(1.0f);
+    shifts.push_back(8.0f);
+    shifts.push_back(64.0f);
+  }
+  if (layouts.empty())
+  {
+    layouts.push_back("row-major");
+    layouts.push_back("blocked");
+    layouts.push_back("morton");
+  }
+  if (orders.empty())
+  {
+    orders.push_back("rows");
+    orders.push_back("tiles");
+  }
+  if (block < 1 || (block & (block - 1)) != 0 || tile < 1)
+  {
+    fprintf(stderr, "Error: -block must be a power of two and -tile positive\n");
+    return -1;
+  }
+  for (size_t k = 0; k < layouts.size(); ++k)
+  {
+    cfdLayout kind;
+    if (parseLayout(layouts[k], kind) != 0)
+    {
+      fprintf(stderr, "Error: unknown layout %s, use row-major, blocked or morton\n", layouts[k].c_str());
+      return -1;
+    }
+  }
+  for (size_t k = 0; k < orders.size(); ++k)
+  {
+    if (orders[k] != "rows" && orders[k] != "tiles")
+    {
+      fprintf(stderr, "Error: unknown order %s, use rows or tiles\n", orders[k].c_str());
+      return -1;
+    }
+  }
+#ifdef _OPENMP
+  if (threads > 0)
+    omp_set_num_threads(threads);
+  threads = omp_get_max_threads();
+#else
+  threads = 1;
+#endif
+
+  const float Dx = 1.0f, dt = 1.0f/24.0f;
+  vector<layoutResult> results;
+
+  printf("%d threads, %d cell blocks, %d cell tiles\n", threads, block, tile);
+  printf("%6s %7s %-10s %-6s %8s %12s %8s %5s\n", "N", "shift", "layout", "order", "calls", "ns/cell", "speedup", "same");
+  for (size_t si = 0; si < sizes.size(); ++si)
+  {
+    for (size_t hi = 0; hi < shifts.size(); ++hi)
+    {
+      // row-major rows is what cfd does, everything is compared with it
+      const double cells = (double) sizes[si] * sizes[si];
+      layoutFields fields;
+      vector<float> reference, output;
+      int calls;
+      fillFields(fields, makeFieldLayout(LAYOUT_ROW_MAJOR, sizes[si], sizes[si], block), shifts[hi], dt);
+      const double baseline = timeSteps(fields, false, tile, Dx, dt, min_time, &calls) * 1e9 / cells;
+      rowMajorOutput(fields, reference);
+
+      for (size_t li = 0; li < layouts.size(); ++li)
+      {
+        cfdLayout kind = LAYOUT_ROW_MAJOR;
+        parseLayout(layouts[li], kind);
+        fillFields(fields, makeFieldLayout(kind, sizes[si], sizes[si], block), shifts[hi], dt);
+
+        for (size_t oi = 0; oi < orders.size(); ++oi)
+        {
+          const bool tiles = orders[oi] == "tiles";
+          const double seconds = timeSteps(fields, tiles, tile, Dx, dt, min_time, &calls);
+          rowMajorOutput(fields, output);
+
+          layoutResult r;
+          r.n = sizes[si];
+          r.shift = shifts[hi];
+          r.layout = layouts[li];
+          r.order = orders[oi];
+          r.calls = calls;
+          r.ns_per_cell = seconds * 1e9 / cells;
+          r.speedup = baseline / r.ns_per_cell;
+          r.same = memcmp(&output[0], &reference[0], output.size() * sizeof(float)) == 0;
+          results.push_back(r);
+
+          printf("%6d %7g %-10s %-6s %8d %12.3f %7.2fx %5s\n", r.n, r.shift, r.layout.c_str(), r.order.c_str(),
+                 r.calls, r.ns_per_cell, r.speedup, r.same ? "yes" : "NO");
+          fflush(stdout);
+        }
+      }
+    }
+  }
+
+  if (!json_path.empty())
+  {
+    FILE *fp = fopen(json_path.c_str(), "w");
+    if (fp == NULL)
+    {
+      fprintf(stderr, "Error: cannot write %s\n", json_path.c_str());
+      return -1;
+    }
+    fprintf(fp, "{\n  \"benchmark\": \"cfd_layout_bench\",\n  \"threads\": %d,\n  \"block\": %d,\n  \"tile\": %d,\n",
+            threads, block, tile);
+    fprintf(fp, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const layoutResult& r = results[i];
+      fprintf(fp, "    {\"n\": %d, \"shift\": %g, \"layout\": \"%s\", \"order\": \"%s\", \"calls\": %d, "
+                  "\"ns_per_cell\": %.6g, \"speedup\": %.4g, \"same\": %s}%s\n",
+              r.n, r.shift, r.layout.c_str(), r.order.c_str(), r.calls, r.ns_per_cell, r.speedup,
+              r.same ? "true" : "false", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+  }
+
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    if (!results[i].same)
+      return 1;
+  }
+  return 0;
+}
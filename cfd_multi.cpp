@@ -0,0 +1,117 @@
+//------------------------------------------------
+//
+//  Program: cfd_multi
+//
+//  Steps many independent headless simulations of
+//  mixed grid sizes together on a cfdEngine and
+//  reports the throughput in cells per second.
+//
+//  usage:
+//
+//  cfd_multi [-instances N] [-min_size S] [-max_size S]
+//            [-frames F] [-threads T] [-scenario name]
+//            [-compare 1]
+//
+//  Instance sizes are spread evenly from -min_size to
+//  -max_size. Each instance replays the scenario
+//  resized to its grid. With -compare 1 the same
+//  instances are also stepped one after another on a
+//  single thread for reference.
+//
+//-------------------------------------------------
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "CmdLineFind.h"
+#include "cfdEngine.h"
+#include "cfdScenario.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+using namespace std;
+using namespace lux;
+
+
+int main(int argc, char** argv)
+{
+  CmdLineFind clf(argc, argv);
+
+  int ninstances = clf.find("-instances", 32, "Number of simulations");
+  int min_size = clf.find("-min_size", 128, "Smallest grid size");
+  int max_size = clf.find("-max_size", 256, "Largest grid size");
+  int frames = clf.find("-frames", 48, "Steps of every simulation");
+  int threads = clf.find("-threads", 0, "Worker threads (0 uses one per core)");
+  string scenario_name = clf.find("-scenario", "startup", "Scenario each instance replays, see cfdScenario.cpp");
+  bool compare = clf.find("-compare", 0, "Also step the instances one by one on one thread") != 0;
+
+  clf.usage("-h");
+  clf.printFinds();
+
+  const vector<cfdScenario> scenarios = defaultScenarios();
+  cfdScenario base;
+  bool found = false;
+  for (size_t s = 0; s < scenarios.size(); ++s)
+  {
+    if (scenarios[s].name == scenario_name) { base = scenarios[s]; found = true; }
+  }
+  if (!found)
+  {
+    fprintf(stderr, "Error: unknown scenario %s\n", scenario_name.c_str());
+    return -1;
+  }
+  if (ninstances < 1) { ninstances = 1; }
+  if (max_size < min_size) { max_size = min_size; }
+
+  vector<cfdScenario> runs;
+  for (int k = 0; k < ninstances; ++k)
+  {
+    const int n = ninstances > 1 ? min_size + (max_size - min_size) * k / (ninstances - 1) : min_size;
+    runs.push_back(resizeScenario(base, n, n));
+  }
+
+  cfdEngine engine(threads);
+  vector<scenarioSources*> sources;
+  for (int k = 0; k < ninstances; ++k)
+  {
+    engine.add(runs[k].nx, runs[k].ny, 1.0, runs[k].dt, runs[k].nloops, runs[k].oploops);
+    sources.push_back(new scenarioSources(runs[k].nx, runs[k].ny, runs[k].brushSize));
+  }
+
+  for (int frame = 0; frame < frames; ++frame)
+  {
+    // dabs are cheap next to a step, paint them all before stepping
+    for (int k = 0; k < ninstances; ++k)
+      sources[k]->apply(runs[k], frame % runs[k].steps, engine.instance(k));
+    engine.step();
+  }
+  printf("engine:     %d instances on %d threads, %.4g Mcells/s, %lld steps stolen\n",
+         engine.size(), engine.threads(), engine.cellsPerSecond() * 1e-6, engine.stolenSteps());
+
+  if (compare)
+  {
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+    double cells = 0.0, seconds = 0.0;
+    for (int k = 0; k < ninstances; ++k)
+    {
+      cfd fluid(runs[k].nx, runs[k].ny, 1.0, runs[k].dt, runs[k].nloops, runs[k].oploops);
+      scenarioSources paint(runs[k].nx, runs[k].ny, runs[k].brushSize);
+      for (int frame = 0; frame < frames; ++frame)
+      {
+        paint.apply(runs[k], frame % runs[k].steps, fluid);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fluid.step();
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cells += (double) runs[k].nx * runs[k].ny;
+      }
+    }
+    printf("sequential: %d instances on 1 thread, %.4g Mcells/s\n", ninstances, cells / seconds * 1e-6);
+  }
+
+  for (size_t k = 0; k < sources.size(); ++k) { delete sources[k]; }
+  return 0;
+}
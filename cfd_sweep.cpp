@@ -0,0 +1,219 @@
+//------------------------------------------------
+//
+//  Program: cfd_sweep
+//
+//  Runs one headless scenario over every combination
+//  of grid size, pressure loops, projection loops and
+//  time step, several runs at once, to find the
+//  cheapest settings that still meet a divergence
+//  target.
+//
+//  usage:
+//
+//  cfd_sweep [-size N]... [-nloops L]... [-oploops P]...
+//            [-dt T]... [-scenario name] [-steps S]
+//            [-jobs J] [-threads_per_job T]
+//            [-max_residual R] [-json results.json]
+//
+//  For each configuration it reports the mean time
+//  per frame, the RMS divergence left after the last
+//  frame and a checksum of the final color field, and
+//  per grid size names the cheapest configuration
+//  whose residual is within -max_residual. Frame times
+//  are measured with the other jobs running, so keep
+//  -jobs * -threads_per_job at or below the core count.
+//
+//-------------------------------------------------
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "CmdLineFind.h"
+#include "cfd.h"
+#include "cfdScenario.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+using namespace std;
+using namespace lux;
+
+
+struct sweepConfig
+{
+  int   n;
+  int   nloops, oploops;
+  float dt;
+};
+
+
+struct sweepResult
+{
+  sweepConfig config;
+  double   seconds_per_frame;
+  float    residual;
+  uint64_t checksum;
+};
+
+
+// FNV-1a over the bytes of the field, identical runs give identical sums
+static uint64_t checksum(const float* field, size_t count)
+{
+  const unsigned char* bytes = (const unsigned char*) field;
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t k = 0; k < count * sizeof(float); ++k)
+  {
+    hash ^= bytes[k];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+
+static sweepResult runConfig(const cfdScenario& base, const sweepConfig& config)
+{
+  cfdScenario scenario = resizeScenario(base, config.n, config.n);
+  scenario.nloops = config.nloops;
+  scenario.oploops = config.oploops;
+  scenario.dt = config.dt;
+
+  cfd fluid(scenario.nx, scenario.ny, 1.0, scenario.dt, scenario.nloops, scenario.oploops);
+  scenarioSources sources(scenario.nx, scenario.ny, scenario.brushSize);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int step = 0; step < scenario.steps; ++step)
+  {
+    sources.apply(scenario, step, fluid);
+    fluid.step();
+  }
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  sweepResult result;
+  result.config = config;
+  result.seconds_per_frame = elapsed / scenario.steps;
+  result.residual = fluid.divergenceResidual();
+  result.checksum = checksum(fluid.getColorPointer(), (size_t) scenario.nx*scenario.ny*3);
+  return result;
+}
+
+
+int main(int argc, char** argv)
+{
+  CmdLineFind clf(argc, argv);
+
+  vector<int> sizes = clf.findMultiple("-size", 128, "Grid size N for an N x N grid (repeatable)");
+  vector<int> nloops = clf.findMultiple("-nloops", 3, "Number of loops over pressure (repeatable)");
+  vector<int> oploops = clf.findMultiple("-oploops", 1, "Number of orthogonal projection loops (repeatable)");
+  vector<float> dts = clf.findMultiple("-dt", (float) (1.0/24.0), "Time step (repeatable)");
+  string scenario_name = clf.find("-scenario", "startup", "Scenario to run, see cfdScenario.cpp");
+  int steps = clf.find("-steps", 0, "Frames per run (0 keeps the scenario's own)");
+  int jobs = clf.find("-jobs", (int) std::thread::hardware_concurrency(), "Runs at once");
+  int threads_per_job = clf.find("-threads_per_job", 1, "OpenMP threads inside each run");
+  float max_residual = clf.find("-max_residual", 0.0f, "Divergence target for the cheapest pick (0 skips it)");
+  string json_path = clf.find("-json", "", "Write results to this JSON file");
+
+  clf.usage("-h");
+  clf.printFinds();
+
+  if (sizes.empty()) { sizes.push_back(128); sizes.push_back(256); }
+  if (nloops.empty()) { nloops.push_back(3); nloops.push_back(10); nloops.push_back(30); }
+  if (oploops.empty()) { oploops.push_back(1); oploops.push_back(2); }
+  if (dts.empty()) { dts.push_back((float) (1.0/24.0)); }
+  if (jobs < 1) { jobs = 1; }
+
+  const vector<cfdScenario> scenarios = defaultScenarios();
+  cfdScenario base;
+  bool found = false;
+  for (size_t s = 0; s < scenarios.size(); ++s)
+  {
+    if (scenarios[s].name == scenario_name) { base = scenarios[s]; found = true; }
+  }
+  if (!found)
+  {
+    fprintf(stderr, "Error: unknown scenario %s\n", scenario_name.c_str());
+    return -1;
+  }
+  if (steps > 0) { base.steps = steps; }
+
+  vector<sweepConfig> configs;
+  for (size_t si = 0; si < sizes.size(); ++si)
+    for (size_t li = 0; li < nloops.size(); ++li)
+      for (size_t oi = 0; oi < oploops.size(); ++oi)
+        for (size_t di = 0; di < dts.size(); ++di)
+        {
+          sweepConfig c = { sizes[si], nloops[li], oploops[oi], dts[di] };
+          configs.push_back(c);
+        }
+
+  // every job pulls the next configuration until none are left
+  vector<sweepResult> results(configs.size());
+  std::atomic<size_t> next(0);
+  vector<std::thread> workers;
+  for (int w = 0; w < jobs && w < (int) configs.size(); ++w)
+  {
+    workers.push_back(std::thread([&]()
+    {
+#ifdef _OPENMP
+      omp_set_num_threads(threads_per_job);
+#endif
+      for (size_t c = next++; c < configs.size(); c = next++)
+        results[c] = runConfig(base, configs[c]);
+    }));
+  }
+  for (size_t w = 0; w < workers.size(); ++w) { workers[w].join(); }
+
+  printf("%6s %7s %8s %9s %12s %12s %18s\n", "N", "nloops", "oploops", "dt", "ms/frame", "residual", "checksum");
+  for (size_t r = 0; r < results.size(); ++r)
+  {
+    const sweepResult& s = results[r];
+    printf("%6d %7d %8d %9.5f %12.4f %12.5g   %016llx\n", s.config.n, s.config.nloops, s.config.oploops,
+           s.config.dt, s.seconds_per_frame * 1e3, s.residual, (unsigned long long) s.checksum);
+  }
+
+  if (max_residual > 0.0f)
+  {
+    printf("\ncheapest within residual %g:\n", max_residual);
+    for (size_t si = 0; si < sizes.size(); ++si)
+    {
+      const sweepResult* best = 0;
+      for (size_t r = 0; r < results.size(); ++r)
+      {
+        if (results[r].config.n != sizes[si] || results[r].residual > max_residual) { continue; }
+        if (best == 0 || results[r].seconds_per_frame < best->seconds_per_frame) { best = &results[r]; }
+      }
+      if (best == 0)
+        printf("%6d  none\n", sizes[si]);
+      else
+        printf("%6d  -nloops %d -oploops %d -dt %g  (%.4f ms/frame)\n", sizes[si], best->config.nloops,
+               best->config.oploops, best->config.dt, best->seconds_per_frame * 1e3);
+    }
+  }
+
+  if (!json_path.empty())
+  {
+    FILE *fp = fopen(json_path.c_str(), "w");
+    if (fp == NULL)
+    {
+      fprintf(stderr, "Error: cannot write %s\n", json_path.c_str());
+      return -1;
+    }
+    fprintf(fp, "{\n  \"benchmark\": \"cfd_sweep\",\n  \"scenario\": \"%s\",\n  \"steps\": %d,\n  \"results\": [\n",
+            base.name.c_str(), base.steps);
+    for (size_t r = 0; r < results.size(); ++r)
+    {
+      const sweepResult& s = results[r];
+      fprintf(fp, "    {\"n\": %d, \"nloops\": %d, \"oploops\": %d, \"dt\": %g, \"seconds_per_frame\": %.9g, "
+                  "\"residual\": %.6g, \"checksum\": \"%016llx\"}%s\n",
+              s.config.n, s.config.nloops, s.config.oploops, s.config.dt, s.seconds_per_frame, s.residual,
+              (unsigned long long) s.checksum, r + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+  }
+  return 0;
+}
@@ -0,0 +1,649 @@
+//------------------------------------------------
+//
+//  Program: cfd_verify
+//
+//  Checks the cfd solver against cfdReference, the
+//  original scalar implementation, on seeded
+//  scenarios of sources, obstructions and divergence
+//  dabs. Both solvers are stepped side by side and
+//  every field is compared after every step. Also
+//  reports how much faster cfd is on each case.
+//
+//  Some scenarios also run in variants of cfd that
+//  must keep to the reference: random and odd with
+//  deferred color resolved after every step, and
+//  odd resolving only every 4th step through a flow
+//  of whole cells per step, where the composed map
+//  must give what advecting every step does. And
+//  random with the flow frozen halfway, where every
+//  advect must move color as a plain cfd advecting
+//  the same state does, also after the sources that
+//  change the flow. obstacles runs again at a grid
+//  spacing other than 1, and with solid cells
+//  skipped, where there is no reference to match:
+//  solids must keep velocity and pressure at 0 and
+//  every field must stay finite. Its speedup is
+//  against the same cfd not skipping.
+//
+//  It then checks cfdBatch the same way: every lane
+//  replays its own random scenario and must match a
+//  cfd running that scenario. The speedup there is
+//  the batch against one cfd per lane.
+//
+//  usage:
+//
+//  cfd_verify [-scenario name]... [-seeds N]
+//             [-threads T] [-tol_<field> value]
+//             [-batch_size N] [-json results.json]
+//
+//  Exits with 1 if any field of any case is off by
+//  more than its tolerance. Errors are measured
+//  relative to the largest magnitude of the field in
+//  the reference, or absolute when that is below 1.
+//
+//-------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "CmdLineFind.h"
+#include "cfd.h"
+#include "cfdBatch.h"
+#include "cfdReference.h"
+#include "cfdScenario.h"
+#include "displayConvert.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+using namespace std;
+using namespace lux;
+
+enum { FIELD_COLOR, FIELD_DENSITY, FIELD_VELOCITY, FIELD_PRESSURE, FIELD_DIVERGENCE, FIELD_OBSTRUCTION, FIELD_COUNT };
+static const char* field_names[FIELD_COUNT] = { "color", "density", "velocity", "pressure", "divergence", "obstruction" };
+
+
+// how a case runs cfd against the reference
+enum { CASE_REFERENCE, CASE_DEFERRED_COLOR, CASE_COMPOSED_COLOR, CASE_FROZEN_FLOW, CASE_SKIP_SOLIDS };
+
+struct verifyCase
+{
+  string      name;
+  int         kind;
+  cfdScenario scenario;
+  float       dx;
+};
+
+
+struct verifyResult
+{
+  string name;
+  bool   passed;
+  int    first_failed_step;
+  float  error[FIELD_COUNT]; // worst over all steps
+  double reference_seconds[2], optimized_seconds[2]; // advect, sources
+};
+
+
+static float fieldError(const float* reference, const float* optimized, size_t count)
+{
+  float largest = 1.0f, worst = 0.0f;
+  for (size_t k = 0; k < count; ++k)
+  {
+    if (std::fabs(reference[k]) > largest) { largest = std::fabs(reference[k]); }
+    const float difference = std::fabs(reference[k] - optimized[k]);
+    // a NaN in either field always fails
+    if (!(difference <= worst)) { worst = difference != difference ? INFINITY : difference; }
+  }
+  return worst / largest;
+}
+
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// one instance of a cfdBatch, with the setters scenarioSources expects
+struct batchLane
+{
+  cfdBatch *batch;
+  int      lane;
+  void setDensitySourceField(float* f)     { batch->setDensitySourceField(lane, f); }
+  void setColorSourceField(float* f)       { batch->setColorSourceField(lane, f); }
+  void setObstructionSourceField(float* f) { batch->setObstructionSourceField(lane, f); }
+  void setDivergenceSourceField(float* f)  { batch->setDivergenceSourceField(lane, f); }
+};
+
+
+static void resetResult(verifyResult& result, const string& name)
+{
+  result.name = name;
+  result.passed = true;
+  result.first_failed_step = -1;
+  for (int f = 0; f < FIELD_COUNT; ++f) { result.error[f] = 0.0f; }
+  for (int p = 0; p < 2; ++p) { result.reference_seconds[p] = result.optimized_seconds[p] = 0.0; }
+}
+
+
+static void compareFields(verifyResult& result, const float* const* reference_fields,
+                          const float* const* optimized_fields, const size_t* counts,
+                          const float* tolerance, int step)
+{
+  for (int f = 0; f < FIELD_COUNT; ++f)
+  {
+    const float error = fieldError(reference_fields[f], optimized_fields[f], counts[f]);
+    if (error > result.error[f]) { result.error[f] = error; }
+    if (!(error <= tolerance[f]) && result.passed)
+    {
+      result.passed = false;
+      result.first_failed_step = step;
+    }
+  }
+}
+
+
+static verifyResult verify(const verifyCase& c, const float* tolerance, bool fused_display)
+{
+  const cfdScenario& scenario = c.scenario;
+  cfdReference reference(scenario.nx, scenario.ny, c.dx, scenario.dt, scenario.nloops, scenario.oploops);
+  cfd optimized(scenario.nx, scenario.ny, c.dx, scenario.dt, scenario.nloops, scenario.oploops);
+  scenarioSources reference_sources(scenario.nx, scenario.ny, scenario.brushSize);
+  scenarioSources optimized_sources(scenario.nx, scenario.ny, scenario.brushSize);
+
+  // let cfd take its fused display path too, it must not change the fields
+  vector<unsigned char> display((size_t) scenario.nx*scenario.ny*3);
+  if (fused_display)
+    optimized.setDisplayTarget(&display[0], 1.0f, 0);
+  if (c.kind == CASE_DEFERRED_COLOR)
+    optimized.setDeferredColor(true);
+
+  verifyResult result;
+  resetResult(result, c.name);
+
+  const size_t cells = (size_t) scenario.nx*scenario.ny;
+  const size_t counts[FIELD_COUNT] = { cells*3, cells, cells*2, cells, cells, cells };
+
+  for (int step = 0; step < scenario.steps; ++step)
+  {
+    reference_sources.apply(scenario, step, reference);
+    optimized_sources.apply(scenario, step, optimized);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    reference.advect();
+    result.reference_seconds[0] += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    reference.sources();
+    result.reference_seconds[1] += secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    optimized.advect();
+    result.optimized_seconds[0] += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    optimized.sources();
+    if (c.kind == CASE_DEFERRED_COLOR)
+      optimized.resolveColor();
+    result.optimized_seconds[1] += secondsSince(start);
+
+    const float* reference_fields[FIELD_COUNT] = {
+      reference.getColorPointer(), reference.getDensityPointer(), reference.getVelocityPointer(),
+      reference.getPressurePointer(), reference.getDivergencePointer(), reference.getObstructionPointer() };
+    const float* optimized_fields[FIELD_COUNT] = {
+      optimized.getColorPointer(), optimized.getDensityPointer(), optimized.getVelocityPointer(),
+      optimized.getPressurePointer(), optimized.getDivergencePointer(), optimized.getObstructionPointer() };
+
+    compareFields(result, reference_fields, optimized_fields, counts, tolerance, step);
+  }
+  return result;
+}
+
+
+static void copyState(const cfd& from, cfd& to)
+{
+  const size_t cells = (size_t) from.getNx()*from.getNy();
+  std::copy(from.getColorPointer(), from.getColorPointer() + cells*3, to.getColorPointer());
+  std::copy(from.getDensityPointer(), from.getDensityPointer() + cells, to.getDensityPointer());
+  std::copy(from.getVelocityPointer(), from.getVelocityPointer() + cells*2, to.getVelocityPointer());
+  std::copy(from.getPressurePointer(), from.getPressurePointer() + cells, to.getPressurePointer());
+  std::copy(from.getDivergencePointer(), from.getDivergencePointer() + cells, to.getDivergencePointer());
+}
+
+
+// A plain cfd is the reference here, advecting color every step, against
+// deferred color resolved every 4th step. Nothing but advect runs, through
+// a uniform flow of one cell per step in x and two in y. Its backtraces
+// land on whole cells, and velocity advects to either that flow or 0 where
+// it came from off the grid, so every map composed from them is whole
+// cells too and the two must agree exactly, at the edges as well.
+static verifyResult verifyComposed(const verifyCase& c, const float* tolerance)
+{
+  const cfdScenario& scenario = c.scenario;
+  const int resolve_every = 4;
+  const float dt = 0.25f;
+  cfd plain(scenario.nx, scenario.ny, 1.0, dt, scenario.nloops, scenario.oploops);
+  cfd deferred(scenario.nx, scenario.ny, 1.0, dt, scenario.nloops, scenario.oploops);
+  deferred.setDeferredColor(true);
+
+  const size_t cells = (size_t) scenario.nx*scenario.ny;
+  for (size_t k = 0; k < cells; ++k)
+  {
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      const float value = (float) ((k*7 + ch*13) % 17) / 16.0f;
+      plain.getColorPointer()[3*k+ch] = deferred.getColorPointer()[3*k+ch] = value;
+    }
+    plain.getVelocityPointer()[2*k] = deferred.getVelocityPointer()[2*k] = 1.0f / dt;
+    plain.getVelocityPointer()[2*k+1] = deferred.getVelocityPointer()[2*k+1] = 2.0f / dt;
+  }
+
+  verifyResult result;
+  resetResult(result, c.name);
+
+  for (int step = 0; step < scenario.steps; ++step)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    plain.advect();
+    result.reference_seconds[0] += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    deferred.advect();
+    result.optimized_seconds[0] += secondsSince(start);
+    if ((step + 1) % resolve_every != 0) { continue; }
+
+    // the resample is the deferred half of advecting color
+    start = std::chrono::steady_clock::now();
+    deferred.resolveColor();
+    result.optimized_seconds[0] += secondsSince(start);
+
+    const float error[2] = {
+      fieldError(plain.getColorPointer(), deferred.getColorPointer(), cells*3),
+      fieldError(plain.getVelocityPointer(), deferred.getVelocityPointer(), cells*2) };
+    const int fields[2] = { FIELD_COLOR, FIELD_VELOCITY };
+    for (int f = 0; f < 2; ++f)
+    {
+      if (error[f] > result.error[fields[f]]) { result.error[fields[f]] = error[f]; }
+      if (!(error[f] <= tolerance[fields[f]]) && result.passed)
+      {
+        result.passed = false;
+        result.first_failed_step = step;
+      }
+    }
+  }
+  return result;
+}
+
+
+// A plain cfd is the reference here. The flow is frozen halfway; after that
+// the scenario only paints a divergence, an obstruction and a density dab,
+// a few held steps apart. Before every step the plain cfd takes over the
+// frozen one's fields, and the color each advect leaves must agree: the
+// first frozen step, the held ones, and the ones after each rebuild. The
+// steps with a dab must also move the velocity, or the flow stayed frozen.
+static verifyResult verifyFrozen(const verifyCase& c, const float* tolerance)
+{
+  cfdScenario scenario = c.scenario;
+  const int freeze = scenario.steps / 2;
+  vector<scenarioDab> dabs;
+  for (size_t d = 0; d < scenario.dabs.size(); ++d)
+  {
+    if (scenario.dabs[d].step < freeze) { dabs.push_back(scenario.dabs[d]); }
+  }
+  const int modes[3] = { SCENARIO_DIVERGENCE_POSITIVE, SCENARIO_OBSTRUCTION, SCENARIO_SOURCE };
+  for (int m = 0; m < 3; ++m)
+  {
+    scenarioDab dab = { freeze + 4 + 4*m, modes[m], scenario.nx/2 + 8*m, scenario.ny/2 };
+    dabs.push_back(dab);
+  }
+  scenario.dabs = dabs;
+
+  cfd plain(scenario.nx, scenario.ny, 1.0, scenario.dt, scenario.nloops, scenario.oploops);
+  cfd frozen(scenario.nx, scenario.ny, 1.0, scenario.dt, scenario.nloops, scenario.oploops);
+  scenarioSources plain_sources(scenario.nx, scenario.ny, scenario.brushSize);
+  scenarioSources frozen_sources(scenario.nx, scenario.ny, scenario.brushSize);
+
+  verifyResult result;
+  resetResult(result, c.name);
+
+  const size_t cells = (size_t) scenario.nx*scenario.ny;
+  vector<float> held(cells*2);
+  for (int step = 0; step < scenario.steps; ++step)
+  {
+    if (step == freeze)
+      frozen.setFrozenFlow(true);
+    plain_sources.apply(scenario, step, plain);
+    frozen_sources.apply(scenario, step, frozen);
+    copyState(frozen, plain);
+    std::copy(frozen.getVelocityPointer(), frozen.getVelocityPointer() + cells*2, held.begin());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    plain.advect();
+    if (step >= freeze) { result.reference_seconds[0] += secondsSince(start); }
+    start = std::chrono::steady_clock::now();
+    frozen.advect();
+    if (step >= freeze) { result.optimized_seconds[0] += secondsSince(start); }
+
+    const float error = fieldError(plain.getColorPointer(), frozen.getColorPointer(), cells*3);
+    if (error > result.error[FIELD_COLOR]) { result.error[FIELD_COLOR] = error; }
+    if (!(error <= tolerance[FIELD_COLOR]) && result.passed)
+    {
+      result.passed = false;
+      result.first_failed_step = step;
+    }
+
+    start = std::chrono::steady_clock::now();
+    plain.sources();
+    if (step >= freeze) { result.reference_seconds[1] += secondsSince(start); }
+    start = std::chrono::steady_clock::now();
+    frozen.sources();
+    if (step >= freeze) { result.optimized_seconds[1] += secondsSince(start); }
+
+    bool dabbed = false;
+    for (size_t d = 0; d < scenario.dabs.size(); ++d) { dabbed = dabbed || scenario.dabs[d].step == step; }
+    if (step >= freeze && dabbed && result.passed &&
+        std::equal(held.begin(), held.end(), frozen.getVelocityPointer()))
+    {
+      result.passed = false;
+      result.first_failed_step = step;
+    }
+  }
+  return result;
+}
+
+
+// infinity if any value of the field is not finite, else the worst magnitude
+// over the cells where obstruction is 0 when those must be 0, else 0
+static float solidError(const float* field, int components, const float* obstruction, size_t cells,
+                        bool zero_in_solids)
+{
+  float worst = 0.0f;
+  for (size_t k = 0; k < cells*components; ++k)
+  {
+    if (!std::isfinite(field[k])) { return INFINITY; }
+    if (zero_in_solids && obstruction[k / components] == 0.0f && std::fabs(field[k]) > worst)
+      worst = std::fabs(field[k]);
+  }
+  return worst;
+}
+
+
+// There is no reference for skipped solids, only what must hold: velocity
+// and pressure exactly 0 in solids and every field finite. A cfd that does
+// not skip runs the same scenario for the speedup.
+static verifyResult verifySkipSolids(const verifyCase& c)
+{
+  const cfdScenario& scenario = c.scenario;
+  cfd plain(scenario.nx, scenario.ny, c.dx, scenario.dt, scenario.nloops, scenario.oploops);
+  cfd skipping(scenario.nx, scenario.ny, c.dx, scenario.dt, scenario.nloops, scenario.oploops);
+  skipping.setSkipSolids(true);
+  scenarioSources plain_sources(scenario.nx, scenario.ny, scenario.brushSize);
+  scenarioSources skipping_sources(scenario.nx, scenario.ny, scenario.brushSize);
+
+  verifyResult result;
+  resetResult(result, c.name);
+
+  const size_t cells = (size_t) scenario.nx*scenario.ny;
+  for (int step = 0; step < scenario.steps; ++step)
+  {
+    plain_sources.apply(scenario, step, plain);
+    skipping_sources.apply(scenario, step, skipping);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    plain.advect();
+    result.reference_seconds[0] += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    plain.sources();
+    result.reference_seconds[1] += secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    skipping.advect();
+    result.optimized_seconds[0] += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    skipping.sources();
+    result.optimized_seconds[1] += secondsSince(start);
+
+    const float* obstruction = skipping.getObstructionPointer();
+    float error[FIELD_COUNT];
+    error[FIELD_COLOR] = solidError(skipping.getColorPointer(), 3, obstruction, cells, false);
+    error[FIELD_DENSITY] = solidError(skipping.getDensityPointer(), 1, obstruction, cells, false);
+    error[FIELD_VELOCITY] = solidError(skipping.getVelocityPointer(), 2, obstruction, cells, true);
+    error[FIELD_PRESSURE] = solidError(skipping.getPressurePointer(), 1, obstruction, cells, true);
+    error[FIELD_DIVERGENCE] = solidError(skipping.getDivergencePointer(), 1, obstruction, cells, false);
+    error[FIELD_OBSTRUCTION] = solidError(obstruction, 1, obstruction, cells, false);
+    for (int f = 0; f < FIELD_COUNT; ++f)
+    {
+      if (error[f] > result.error[f]) { result.error[f] = error[f]; }
+      if (!(error[f] == 0.0f) && result.passed)
+      {
+        result.passed = false;
+        result.first_failed_step = step;
+      }
+    }
+  }
+  return result;
+}
+
+
+// cfd is the reference here, each lane against its own instance
+static verifyResult verifyBatch(int n, int steps, const float* tolerance)
+{
+  const int lanes = CFD_BATCH_LANES;
+  cfdBatch batch(n, n, 1.0, (float) (1.0/24.0), 6, 1);
+  vector<cfdScenario> scenarios;
+  vector<cfd*> singles;
+  vector<scenarioSources*> single_sources, batch_sources;
+  for (int l = 0; l < lanes; ++l)
+  {
+    scenarios.push_back(randomScenario("lane", n, n, steps, 100 + l));
+    singles.push_back(new cfd(n, n, 1.0, scenarios[l].dt, scenarios[l].nloops, scenarios[l].oploops));
+    single_sources.push_back(new scenarioSources(n, n, scenarios[l].brushSize));
+    batch_sources.push_back(new scenarioSources(n, n, scenarios[l].brushSize));
+  }
+
+  verifyResult result;
+  resetResult(result, "batch");
+
+  const size_t cells = (size_t) n*n;
+  const size_t counts[FIELD_COUNT] = { cells*3, cells, cells*2, cells, cells, cells };
+  vector<float> lane_fields[FIELD_COUNT];
+  for (int f = 0; f < FIELD_COUNT; ++f) { lane_fields[f].resize(counts[f]); }
+
+  for (int step = 0; step < steps; ++step)
+  {
+    for (int l = 0; l < lanes; ++l)
+    {
+      batchLane lane = { &batch, l };
+      single_sources[l]->apply(scenarios[l], step, *singles[l]);
+      batch_sources[l]->apply(scenarios[l], step, lane);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int l = 0; l < lanes; ++l) { singles[l]->advect(); }
+    result.reference_seconds[0] += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    for (int l = 0; l < lanes; ++l) { singles[l]->sources(); }
+    result.reference_seconds[1] += secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    batch.advect();
+    result.optimized_seconds[0] += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    batch.sources();
+    result.optimized_seconds[1] += secondsSince(start);
+
+    for (int l = 0; l < lanes; ++l)
+    {
+      batch.copyColor(l, &lane_fields[FIELD_COLOR][0]);
+      batch.copyDensity(l, &lane_fields[FIELD_DENSITY][0]);
+      batch.copyVelocity(l, &lane_fields[FIELD_VELOCITY][0]);
+      batch.copyPressure(l, &lane_fields[FIELD_PRESSURE][0]);
+      batch.copyDivergence(l, &lane_fields[FIELD_DIVERGENCE][0]);
+      batch.copyObstruction(l, &lane_fields[FIELD_OBSTRUCTION][0]);
+
+      const float* reference_fields[FIELD_COUNT] = {
+        singles[l]->getColorPointer(), singles[l]->getDensityPointer(), singles[l]->getVelocityPointer(),
+        singles[l]->getPressurePointer(), singles[l]->getDivergencePointer(), singles[l]->getObstructionPointer() };
+      const float* optimized_fields[FIELD_COUNT];
+      for (int f = 0; f < FIELD_COUNT; ++f) { optimized_fields[f] = &lane_fields[f][0]; }
+      compareFields(result, reference_fields, optimized_fields, counts, tolerance, step);
+    }
+  }
+
+  for (int l = 0; l < lanes; ++l)
+  {
+    delete singles[l];
+    delete single_sources[l];
+    delete batch_sources[l];
+  }
+  return result;
+}
+
+
+// a case that does not run a pass shows - for it
+static void printSpeedup(double reference_seconds, double optimized_seconds)
+{
+  if (optimized_seconds > 0.0)
+    printf(" %7.2fx", reference_seconds / optimized_seconds);
+  else
+    printf(" %8s", "-");
+}
+
+
+static verifyCase makeCase(const string& name, int kind, const cfdScenario& scenario)
+{
+  verifyCase c;
+  c.name = name;
+  c.kind = kind;
+  c.scenario = scenario;
+  c.dx = 1.0f;
+  return c;
+}
+
+
+// a scenario against the reference, then the variants it is run in
+static void addCases(vector<verifyCase>& cases, const cfdScenario& scenario)
+{
+  cases.push_back(makeCase(scenario.name, CASE_REFERENCE, scenario));
+  if (scenario.name == "random" || scenario.name == "odd")
+    cases.push_back(makeCase(scenario.name + "-deferred", CASE_DEFERRED_COLOR, scenario));
+  if (scenario.name == "odd")
+    cases.push_back(makeCase(scenario.name + "-composed", CASE_COMPOSED_COLOR, scenario));
+  if (scenario.name == "random")
+    cases.push_back(makeCase(scenario.name + "-frozen", CASE_FROZEN_FLOW, scenario));
+  if (scenario.name == "obstacles")
+  {
+    cases.push_back(makeCase(scenario.name + "-dx", CASE_REFERENCE, scenario));
+    cases.back().dx = 0.3f;
+    cases.push_back(makeCase(scenario.name + "-skip", CASE_SKIP_SOLIDS, scenario));
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  CmdLineFind clf(argc, argv);
+
+  vector<string> names = clf.findMultiple("-scenario", string(""), "Only run this scenario (repeatable)");
+  int seeds = clf.find("-seeds", 0, "Also run this many extra random scenarios");
+  int threads = clf.find("-threads", 0, "OpenMP thread count (0 keeps the default)");
+  bool fused_display = clf.find("-fused_display", 1, "Let cfd convert to display bytes during the step") != 0;
+  float tolerance[FIELD_COUNT];
+  tolerance[FIELD_COLOR] = clf.find("-tol_color", 1e-5f, "Tolerance on color");
+  tolerance[FIELD_DENSITY] = clf.find("-tol_density", 1e-5f, "Tolerance on density");
+  tolerance[FIELD_VELOCITY] = clf.find("-tol_velocity", 1e-4f, "Tolerance on velocity");
+  tolerance[FIELD_PRESSURE] = clf.find("-tol_pressure", 1e-4f, "Tolerance on pressure");
+  tolerance[FIELD_DIVERGENCE] = clf.find("-tol_divergence", 1e-4f, "Tolerance on divergence");
+  tolerance[FIELD_OBSTRUCTION] = clf.find("-tol_obstruction", 0.0f, "Tolerance on obstruction");
+  int batch_size = clf.find("-batch_size", 64, "Grid size of the cfdBatch check (0 skips it)");
+  string json_path = clf.find("-json", "", "Write results to this JSON file");
+
+  clf.usage("-h");
+  clf.printFinds();
+
+#ifdef _OPENMP
+  if (threads > 0) { omp_set_num_threads(threads); }
+#endif
+
+  vector<cfdScenario> all = defaultScenarios();
+  for (int s = 1; s <= seeds; ++s)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "seed%d", s);
+    all.push_back(randomScenario(name, 128, 128, 32, (unsigned int) s));
+  }
+
+  vector<verifyCase> cases;
+  for (size_t s = 0; s < all.size(); ++s)
+  {
+    bool wanted = names.empty();
+    for (size_t n = 0; n < names.size(); ++n) { wanted = wanted || names[n] == all[s].name; }
+    if (wanted) { addCases(cases, all[s]); }
+  }
+  if (cases.empty())
+  {
+    fprintf(stderr, "Error: no scenario matches\n");
+    return -1;
+  }
+
+  vector<verifyResult> results;
+  bool all_passed = true;
+  printf("%-16s %6s", "scenario", "result");
+  for (int f = 0; f < FIELD_COUNT; ++f) { printf(" %11s", field_names[f]); }
+  printf(" %8s %8s %8s\n", "advect", "sources", "step");
+
+  const size_t ncases = cases.size() + (batch_size > 0 ? 1 : 0);
+  for (size_t s = 0; s < ncases; ++s)
+  {
+    verifyResult r;
+    if (s == cases.size())
+      r = verifyBatch(batch_size, 48, tolerance);
+    else if (cases[s].kind == CASE_COMPOSED_COLOR)
+      r = verifyComposed(cases[s], tolerance);
+    else if (cases[s].kind == CASE_FROZEN_FLOW)
+      r = verifyFrozen(cases[s], tolerance);
+    else if (cases[s].kind == CASE_SKIP_SOLIDS)
+      r = verifySkipSolids(cases[s]);
+    else
+      r = verify(cases[s], tolerance, fused_display);
+    results.push_back(r);
+    all_passed = all_passed && r.passed;
+
+    printf("%-16s %6s", r.name.c_str(), r.passed ? "ok" : "FAIL");
+    for (int f = 0; f < FIELD_COUNT; ++f) { printf(" %11.3e", r.error[f]); }
+    printSpeedup(r.reference_seconds[0], r.optimized_seconds[0]);
+    printSpeedup(r.reference_seconds[1], r.optimized_seconds[1]);
+    printSpeedup(r.reference_seconds[0] + r.reference_seconds[1], r.optimized_seconds[0] + r.optimized_seconds[1]);
+    if (!r.passed) { printf("  (first off at step %d)", r.first_failed_step); }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  if (!json_path.empty())
+  {
+    FILE *fp = fopen(json_path.c_str(), "w");
+    if (fp == NULL)
+    {
+      fprintf(stderr, "Error: cannot write %s\n", json_path.c_str());
+      return -1;
+    }
+    fprintf(fp, "{\n  \"benchmark\": \"cfd_verify\",\n  \"passed\": %s,\n  \"results\": [\n", all_passed ? "true" : "false");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const verifyResult& r = results[i];
+      fprintf(fp, "    {\"scenario\": \"%s\", \"passed\": %s, \"first_failed_step\": %d, \"error\": {",
+              r.name.c_str(), r.passed ? "true" : "false", r.first_failed_step);
+      for (int f = 0; f < FIELD_COUNT; ++f)
+        fprintf(fp, "\"%s\": %.6g%s", field_names[f], r.error[f], f + 1 < FIELD_COUNT ? ", " : "");
+      fprintf(fp, "}, \"reference_seconds\": {\"advect\": %.9g, \"sources\": %.9g}, "
+                  "\"optimized_seconds\": {\"advect\": %.9g, \"sources\": %.9g}}%s\n",
+              r.reference_seconds[0], r.reference_seconds[1], r.optimized_seconds[0], r.optimized_seconds[1],
+              i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+  }
+
+  return all_passed ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+//
+// Conversion of float color fields to the 8 bit display map.
+//
+#include <cmath>
+#include "displayConvert.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+static inline float clampTo(float v, float top)
+{
+  return v < 0.0f ? 0.0f : (v > top ? top : v);
+}
+
+
+void floatToDisplayBytes(const float* color, unsigned char* display, int count, float scale, const unsigned char* lut)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  const __m128 zero = _mm_setzero_ps();
+  if (lut == 0)
+  {
+    // 16 floats -> 16 bytes per iteration. cvtt truncates like the
+    // (unsigned char) cast of the scalar path
+    const __m128 s = _mm_set1_ps(scale * 255.0f);
+    const __m128 top = _mm_set1_ps(255.0f);
+    for (; i + 16 <= count; i += 16)
+    {
+      __m128i a = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(color + i),      s), zero), top));
+      __m128i b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(color + i + 4),  s), zero), top));
+      __m128i c = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(color + i + 8),  s), zero), top));
+      __m128i d = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(color + i + 12), s), zero), top));
+      _mm_storeu_si128((__m128i*) (display + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+  }
+  else
+  {
+    // the table lookup itself is scalar, the index math is not
+    const __m128 s = _mm_set1_ps(scale * (DISPLAY_LUT_SIZE - 1));
+    const __m128 top = _mm_set1_ps((float) (DISPLAY_LUT_SIZE - 1));
+    int index[4];
+    for (; i + 4 <= count; i += 4)
+    {
+      _mm_storeu_si128((__m128i*) index, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(color + i), s), zero), top)));
+      display[i]     = lut[index[0]];
+      display[i + 1] = lut[index[1]];
+      display[i + 2] = lut[index[2]];
+      display[i + 3] = lut[index[3]];
+    }
+  }
+#endif
+
+  if (lut == 0)
+  {
+    const float s = scale * 255.0f;
+    for (; i < count; ++i) { display[i] = (unsigned char) clampTo(color[i] * s, 255.0f); }
+  }
+  else
+  {
+    const float s = scale * (DISPLAY_LUT_SIZE - 1);
+    for (; i < count; ++i) { display[i] = lut[(int) clampTo(color[i] * s, (float) (DISPLAY_LUT_SIZE - 1))]; }
+  }
+}
+
+
+void buildDisplayLUT(unsigned char* lut, float gamma)
+{
+  const float exponent = gamma > 0.0f ? 1.0f / gamma : 1.0f;
+  for (int i = 0; i < DISPLAY_LUT_SIZE; ++i)
+  {
+    const float v = powf((float) i / (DISPLAY_LUT_SIZE - 1), exponent);
+    lut[i] = (unsigned char) (v * 255.0f + 0.5f);
+  }
+}
@@ -0,0 +1,18 @@
+//
+// Conversion of float color fields to the 8 bit display map.
+//
+
+#ifndef DISPLAYCONVERT_H
+#define DISPLAYCONVERT_H
+
+#define DISPLAY_LUT_SIZE 4096
+
+// Writes count bytes: display[i] = 255 * clamp(color[i]*scale, 0, 1).
+// If lut is not null the clamped value is instead looked up in a table of
+// DISPLAY_LUT_SIZE entries built by buildDisplayLUT().
+void floatToDisplayBytes(const float* color, unsigned char* display, int count, float scale, const unsigned char* lut);
+
+// fills a DISPLAY_LUT_SIZE table mapping [0,1] to 255 * v^(1/gamma)
+void buildDisplayLUT(unsigned char* lut, float gamma);
+
+#endif //DISPLAYCONVERT_H
@@ -49,14 +49,31 @@
 //-------------------------------------------------
 #define GL_GLEXT_PROTOTYPES 1
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <math.h>
 #include <cmath>
 #include "CmdLineFind.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #include "cfd.h"
+#include "displayConvert.h"
+#include "frameStream.h"
+#include "imageSource.h"
+#include "tileLayout.h"
+#include "tripleBuffer.h"
+#include "spscQueue.h"
+#include "brush.h"
+#include "perfCounters.h"
+#include "phaseTimer.h"
+#include "threadConfig.h"
+#include "cfdTuning.h"
 
 #ifdef __APPLE__
   #include <OpenGL/gl.h>   // OpenGL itself.
@@ -87,23 +104,32 @@ float* divergance_source;
 cfd *fluid;
 int frame_count = 0;
 string output_path;
+string trace_path;
+FILE *perf_file = NULL;
+long perf_frame = 0;
 bool capture_mode;
+frameStreamWriter frame_stream;
+imageSource *image_source = NULL;
+int image_rate;
+float image_gain;
+int step_count = 0;
+int frame_every = 1;
 
 int paint_mode;
 enum{ PAINT_OBSTRUCTION, PAINT_SOURCE, PAINT_DIVERGENCE_POSITIVE, PAINT_DIVERGENCE_NEGATIVE, PAINT_COLOR };
 
-bool toggle_animation_on_off;
 
 float scaling_factor;
+unsigned char *display_lut = NULL; // gamma table, NULL for linear display
+bool fused_display; // the solver converts color to display_map itself
+threadConfig solver_threads; // team size and placement of the solver passes
+std::atomic<bool> frozen_flow(false); // asked for from the keyboard, applied by the solver thread
 
 int BRUSH_SIZE = 11;
-float **obstruction_brush = NULL;
-float **source_brush = NULL;
-
-int xmouse_prev, ymouse_prev;
-
-////////  OpenImageIO reader
+const brushKernel *obstruction_brush = NULL;
+const brushKernel *source_brush = NULL;
 
+int requested_brush_size = BRUSH_SIZE;
 
 void handleError(const char* error_message, int kill)
 {
@@ -121,41 +147,8 @@ void handleError(const char* error_message, int kill)
 //----------------------------------------------------
 
 
-int readOIIOImage( const char* fname)
-{
-  int channels;
-  ImageInput *in = ImageInput::create (fname);
-  if (! in) { return -1; }
-  ImageSpec spec;
-  in->open (fname, spec);
-  iwidth = spec.width; // note iwidth and iheight are set to to image size
-  iheight = spec.height;
-  channels = spec.nchannels;
-  float* pixels = new float[iwidth*iheight*channels];
-  color_source = new float[iwidth*iheight*channels]; // allocate appropriate space for image
-
-  in->read_image (TypeDesc::FLOAT, pixels);
-  long index = 0;
-  for( int j=0;j<iheight;j++)
-  {
-    for( int i=0;i<iwidth;i++ )
-    {
-      for( int c=0;c<channels;c++ )
-      {
-        color_source[ (i + iwidth*(iheight - j - 1))*channels + c ] = pixels[index++];
-      }
-    }
-  }
-  delete pixels;
-
-  in->close ();
-  delete in;
-
-  return 0;
-}
-
-
 void writeImage() {
+  CFD_TRACE_SCOPE("writeImage");
   char buffer[256];
 
   if (sprintf(buffer, "%sfluid_simulator_%04d.jpg", output_path.c_str(), frame_count++) < 0) {
@@ -201,51 +194,16 @@ void writeImage() {
 
 void InitializeBrushes(int new_brush_size)
 {
-  // deallocate old brushes
-  if (source_brush != NULL) {
-    for (int i = 0; i < BRUSH_SIZE; ++i) {delete source_brush[i]; }
-    delete source_brush;
-  }
-  if (obstruction_brush != NULL) {
-    for (int i = 0; i < BRUSH_SIZE; ++i) {delete obstruction_brush[i]; }
-    delete obstruction_brush;
-  }
-
   // set BRUSH_SIZE to the new brush size. clamp min size to 3
   if (new_brush_size < 3)
     BRUSH_SIZE = 3;
   else
     BRUSH_SIZE = new_brush_size;
 
-  // allocate memory for new brushes
-  source_brush = new float*[BRUSH_SIZE];
-  for (int i = 0; i < BRUSH_SIZE; ++i) {source_brush[i] = new float[BRUSH_SIZE]; }
-  obstruction_brush = new float*[BRUSH_SIZE];
-  for (int i = 0; i < BRUSH_SIZE; ++i) {obstruction_brush[i] = new float[BRUSH_SIZE]; }
-
-  int brush_width = (BRUSH_SIZE-1)/2;
-  for( int j=-brush_width;j<=brush_width;j++ )
-  {
-    int jj = j + brush_width;
-    float jfactor =  (float(brush_width) - (float)fabs(j) )/float(brush_width);
-    for( int i=-brush_width;i<=brush_width;i++ )
-    {
-      int ii = i + brush_width;
-      float ifactor =  (float(brush_width) - (float)fabs(i) )/float(brush_width);
-      float radius = (float) ((jfactor * jfactor + ifactor * ifactor) / 2.0);
-      source_brush[ii][jj] = powf(radius,0.5);
-      obstruction_brush[ii][jj] = (float)(1.0 - pow(radius, 1.0/4.0));
-    }
-  }
-}
-
-#ifdef __linux__
-void setNbCores( int nb )
-{
-  omp_set_num_threads( nb );
+  // kernels are cached per size, so switching back and forth is free
+  source_brush = &getBrushKernel(BRUSH_SIZE, BRUSH_FALLOFF_SOURCE);
+  obstruction_brush = &getBrushKernel(BRUSH_SIZE, BRUSH_FALLOFF_OBSTRUCTION);
 }
-#endif
-
 
 //----------------------------------------------------
 //
@@ -254,75 +212,138 @@ void setNbCores( int nb )
 //----------------------------------------------------
 
 
-void ConvertToDisplay()
+// The solver thread publishes finished display frames through a lock-free
+// triple buffer and the GLUT thread always shows the newest one. Each frame
+// carries the tiles that changed since the frame the display had before.
+struct displayFrame
 {
+  vector<unsigned char> pixels; // iwidth*iheight*3 display bytes
+  vector<unsigned char> dirty;  // one flag per solver tile
+  long long input_time;         // oldest brush event in this frame, 0 if none
+};
+tripleBuffer<displayFrame> frames;
+
+// Per frame slot, the tiles that changed since that slot's pixels were last
+// written. Only these are converted when the solver does not fuse the
+// conversion into its step.
+vector<unsigned char> stale_tiles[3];
+vector<unsigned char> last_published_dirty;
+long long last_published_input = 0;
+
+// tiles of display_map that changed since they were last handed to a PBO,
+// and the oldest brush event that went into them
+vector<unsigned char> display_dirty;
+long long display_input_time = 0;
+
+// brightness is changed on the GLUT thread and picked up by the solver
+std::atomic<float> display_scale(1.0f);
+std::atomic<int> display_version(0);
+int converted_version = -1;
+int fused_version = -1; // display_version of the scale the fused rows used
+
+void ConvertToDisplay(bool stepped)
+{
+  CFD_TRACE_SCOPE("ConvertToDisplay");
+  displayFrame &frame = frames.writeBuffer();
+  vector<unsigned char> &stale = stale_tiles[frames.writeIndex()];
   float *color = fluid->getColorPointer();
+  const unsigned char *dirty = fluid->getDirtyTiles();
+  const int tile = fluid->getTileSize();
+  const int tiles_x = fluid->getTilesX();
+  const int ntiles = tiles_x * fluid->getTilesY();
+
+  // fused rows were converted at the version update() read, which may be
+  // older than the current one; marking them newer would keep them stale
+  const int version = stepped && fused_display ? fused_version : display_version.load();
+  const bool refresh = version != converted_version;
+  const float scale = display_scale.load();
+  converted_version = version;
+
+  for (int t = 0; t < ntiles; ++t)
+  {
+    frame.dirty[t] = refresh || (stepped && dirty[t]);
+    if (frame.dirty[t])
+    {
+      for (int s = 0; s < 3; ++s) { stale_tiles[s][t] = 1; }
+    }
+  }
+
+  // with fused_display the step itself already wrote every row of this slot
+  if (!(stepped && fused_display))
+  {
 #ifdef __linux__
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
 #endif
-  for (int i = 0; i < iwidth*iheight*3; ++i) { display_map[i] = (unsigned char)(color[i] * 255.0f); }
+    for (int t = 0; t < ntiles; ++t)
+    {
+      if (!stale[t]) { continue; }
+
+      const int x0 = (t % tiles_x) * tile;
+      const int y0 = (t / tiles_x) * tile;
+      const int x1 = x0 + tile < iwidth ? x0 + tile : iwidth;
+      const int y1 = y0 + tile < iheight ? y0 + tile : iheight;
+      for (int j = y0; j < y1; ++j)
+      {
+        const int offset = (x0 + iwidth*j)*3;
+        floatToDisplayBytes(color + offset, &frame.pixels[offset], (x1 - x0)*3, scale, display_lut);
+      }
+    }
+  }
+  std::fill(stale.begin(), stale.end(), 0);
+
+  // if the display has not picked up the previous frame yet it may never
+  // see it, so this frame has to carry that frame's changes too
+  if (frames.hasUnread())
+  {
+    for (int t = 0; t < ntiles; ++t) { frame.dirty[t] |= last_published_dirty[t]; }
+    if (last_published_input != 0 && (frame.input_time == 0 || last_published_input < frame.input_time))
+      frame.input_time = last_published_input;
+  }
+  last_published_dirty = frame.dirty;
+  last_published_input = frame.input_time;
+  frames.publish();
+
+  // the slot belongs to the display now. the solver only writes through a
+  // target set from frames.writeBuffer(), re-armed before the next step
+  fluid->setDisplayTarget(0, 1.0f, 0);
+}
+
+void applyScaleFactor()
+{
+  display_scale.store(scaling_factor);
+  display_version.fetch_add(1);
 }
 
 void resetScaleFactor( float amount )
 {
    scaling_factor *= amount;
+   applyScaleFactor();
 }
 
 
-void DabSomePaint( int x, int y ) {
+void DabSomePaint( int x, int y, int mode ) {
   float divergence_source_magnitude = 250.0f;
-  int brush_width = (BRUSH_SIZE - 1) / 2;
-  int xstart = x - brush_width;
-  int ystart = y - brush_width;
-  if (xstart < 0) { xstart = 0; }
-  if (ystart < 0) { ystart = 0; }
-
-  int xend = x + brush_width;
-  int yend = y + brush_width;
-  if (xend >= iwidth) { xend = iwidth - 1; }
-  if (yend >= iheight) { yend = iheight - 1; }
-
-  if (paint_mode == PAINT_OBSTRUCTION) {
-    for (int ix = xstart; ix <= xend; ix++) {
-      for (int iy = ystart; iy <= yend; iy++) {
-        int index = ix + iwidth * (iheight - iy - 1);
-        obstruction_source[index] *= obstruction_brush[ix - xstart][iy - ystart];
-      }
-    }
+
+  // y is in window coordinates, rows of the fields start at the bottom
+  const int row = iheight - y - 1;
+
+  if (mode == PAINT_OBSTRUCTION) {
+    stampMultiply(obstruction_source, iwidth, iheight, x, row, *obstruction_brush);
     fluid->setObstructionSourceField(obstruction_source);
   }
-  else if (paint_mode == PAINT_SOURCE) {
-    for (int ix = xstart; ix <= xend; ix++) {
-      for (int iy = ystart; iy <= yend; iy++) {
-        int index = ix + iwidth * (iheight - iy - 1);
-        color_source[3 * index] += source_brush[ix - xstart][iy - ystart];
-        color_source[3 * index + 1] += source_brush[ix - xstart][iy - ystart];
-        color_source[3 * index + 2] += source_brush[ix - xstart][iy - ystart];
-        density_source[index] += source_brush[ix - xstart][iy - ystart];
-      }
-    }
+  else if (mode == PAINT_SOURCE) {
+    stampAddRGB(color_source, iwidth, iheight, x, row, *source_brush, 1.0f);
+    stampAdd(density_source, iwidth, iheight, x, row, *source_brush, 1.0f);
     fluid->setColorSourceField(color_source);
     fluid->setDensitySourceField(density_source);
   }
-  else if (paint_mode == PAINT_DIVERGENCE_POSITIVE ) {
-    for (int ix = xstart; ix <= xend; ix++) {
-      for (int iy = ystart; iy <= yend; iy++) {
-        int index = ix + iwidth * (iheight - iy - 1);
-        //color_source[3 * index + 2] += source_brush[ix - xstart][iy - ystart];
-        divergance_source[index] += source_brush[ix - xstart][iy - ystart]*divergence_source_magnitude;
-      }
-    }
+  else if (mode == PAINT_DIVERGENCE_POSITIVE ) {
+    stampAdd(divergance_source, iwidth, iheight, x, row, *source_brush, divergence_source_magnitude);
     fluid->setColorSourceField(color_source);
     fluid->setDivergenceSourceField(divergance_source);
   }
-  else if ( paint_mode == PAINT_DIVERGENCE_NEGATIVE ) {
-    for (int ix = xstart; ix <= xend; ix++) {
-      for (int iy = ystart; iy <= yend; iy++) {
-        int index = ix + iwidth * (iheight - iy - 1);
-        //color_source[3 * index] += source_brush[ix - xstart][iy - ystart];
-        divergance_source[index] += source_brush[ix - xstart][iy - ystart]*divergence_source_magnitude*(-1.0f);
-      }
-    }
+  else if ( mode == PAINT_DIVERGENCE_NEGATIVE ) {
+    stampAdd(divergance_source, iwidth, iheight, x, row, *source_brush, -divergence_source_magnitude);
     fluid->setColorSourceField(color_source);
     fluid->setDivergenceSourceField(divergance_source);
   }
@@ -331,6 +352,91 @@ void DabSomePaint( int x, int y ) {
 }
 
 
+//----------------------------------------------------
+//
+//  Brush input
+//
+//----------------------------------------------------
+
+
+// Mouse and brush events go from the GLUT thread to the solver through a
+// lock-free queue and are applied in one batch at the start of each step,
+// so the source fields are only ever touched by the solver thread.
+enum{ BRUSH_DOWN, BRUSH_MOVE, BRUSH_RESIZE };
+
+struct brushEvent
+{
+  int kind;
+  int x, y;        // grid coordinates, or the new size for BRUSH_RESIZE
+  int mode;        // paint mode at the time of the event
+  long long time;  // steady clock nanoseconds, for latency reporting
+};
+
+spscQueue<brushEvent, 1024> brush_events;
+int stroke_x = -1, stroke_y = -1;
+
+long long nowNanoseconds()
+{
+  return (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void queueBrushEvent( int kind, int x, int y )
+{
+  brushEvent event;
+  event.kind = kind;
+  event.x = x;
+  event.y = y;
+  event.mode = paint_mode;
+  event.time = nowNanoseconds();
+
+  // window coordinates to grid coordinates
+  if (kind != BRUSH_RESIZE)
+  {
+    event.x = x * iwidth / glutGet(GLUT_WINDOW_WIDTH);
+    event.y = y * iheight / glutGet(GLUT_WINDOW_HEIGHT);
+  }
+  if (!brush_events.push(event))
+    handleError((const char *) "brush event queue is full, dropping input", 0);
+}
+
+// Drains the queue. Consecutive motion events are joined into a stroke with
+// dabs every half brush width, so fast mouse motion leaves no gaps however
+// few events arrive. returns the time of the oldest event applied, or 0
+long long applyBrushEvents()
+{
+  CFD_TRACE_SCOPE("applyBrushEvents");
+  long long oldest = 0;
+  brushEvent event;
+  while (brush_events.pop(event))
+  {
+    if (oldest == 0) { oldest = event.time; }
+
+    if (event.kind == BRUSH_RESIZE)
+    {
+      InitializeBrushes(event.x);
+      continue;
+    }
+
+    if (event.kind == BRUSH_DOWN || stroke_x < 0)
+      DabSomePaint(event.x, event.y, event.mode);
+    else
+    {
+      const int dx = event.x - stroke_x;
+      const int dy = event.y - stroke_y;
+      const int spacing = (BRUSH_SIZE - 1) / 4 > 1 ? (BRUSH_SIZE - 1) / 4 : 1;
+      const int length = std::max(std::abs(dx), std::abs(dy));
+      const int dabs = (length + spacing - 1) / spacing;
+      for (int k = 1; k <= dabs; ++k)
+        DabSomePaint(stroke_x + dx * k / dabs, stroke_y + dy * k / dabs, event.mode);
+    }
+    stroke_x = event.x;
+    stroke_y = event.y;
+  }
+  return oldest;
+}
+
+
 //----------------------------------------------------
 //
 //  GL and GLUT callbacks
@@ -348,19 +454,140 @@ void cbDisplay( void )
 
 void update()
 {
+  CFD_TRACE_SCOPE("update");
+  frames.writeBuffer().input_time = applyBrushEvents();
+
+  // inject the next plate frame every image_rate steps, or just once when
+  // image_rate is 0. if the frame is still decoding we try again next step
+  static bool image_pending = true;
+  if (image_source != NULL)
+  {
+    if (image_rate > 0 && step_count % image_rate == 0)
+      image_pending = true;
+    if (image_pending && image_source->addCurrentFrame(color_source, image_gain))
+    {
+      fluid->setColorSourceField(color_source);
+      image_pending = false;
+    }
+  }
+  ++step_count;
+
+  if (fused_display)
+  {
+    // version before scale: a change in between leaves the frame marked
+    // older than its bytes and converted again, never the other way round
+    fused_version = display_version.load();
+    fluid->setDisplayTarget(&frames.writeBuffer().pixels[0], display_scale.load(), display_lut);
+  }
+  if (fluid->getFrozenFlow() != frozen_flow.load())
+    fluid->setFrozenFlow(frozen_flow.load());
+
   fluid->advect();
   fluid->sources();
 }
 
-// animate and display new result
+// The solver runs on its own thread at a fixed rate, independent of the
+// window system. Frames it falls behind on are not made up.
+std::thread simulation_thread;
+std::atomic<bool> simulation_running(false);
+std::atomic<bool> toggle_animation_on_off;
+double simulation_rate;
+
+void simulationLoop()
+{
+  setTraceThreadName("solver");
+  // this thread opens its own OpenMP team; place it like the one that
+  // first touched the fields in main
+  applyThreadConfig(solver_threads);
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  const std::chrono::steady_clock::duration period = simulation_rate > 0.0 ?
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0/simulation_rate)) :
+      std::chrono::steady_clock::duration::zero();
+
+  while (simulation_running.load())
+  {
+    if (toggle_animation_on_off.load())
+    {
+      update();
+      // with -frame_every color is deferred and only resampled for the
+      // steps that make a frame
+      if (step_count % frame_every == 0)
+      {
+        fluid->resolveColor();
+        {
+          CFD_TRACE_SCOPE("frame_stream publish");
+          frame_stream.publish(fluid->getColorPointer());
+        }
+        ConvertToDisplay(true);
+      }
+      if (perf_file != NULL)
+        perfFrameReport(perf_file, perf_frame++);
+    }
+    else
+    {
+      // keep the paint, it is picked up by the next step
+      applyBrushEvents();
+      if (display_version.load() != converted_version)
+      {
+        // a deferred resample writes display rows if fused, so point it at
+        // the slot being filled, not the one published last
+        if (fused_display)
+          fluid->setDisplayTarget(&frames.writeBuffer().pixels[0], display_scale.load(), display_lut);
+        fluid->resolveColor();
+        frames.writeBuffer().input_time = 0;
+        ConvertToDisplay(false);
+      }
+    }
+
+    next += period;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next < now)
+      next = now;
+    else
+      std::this_thread::sleep_until(next);
+  }
+}
+
+void stopSimulation()
+{
+  simulation_running = false;
+  if (simulation_thread.joinable())
+    simulation_thread.join();
+}
+
+void startSimulation()
+{
+  simulation_running = true;
+  simulation_thread = std::thread(simulationLoop);
+
+  // closing the window makes glut call exit(); join before the globals
+  // the solver uses are destroyed, not just on 'q'
+  static bool registered = false;
+  if (!registered)
+  {
+    atexit(stopSimulation);
+    registered = true;
+  }
+}
+
+// show the newest frame from the solver, if there is one
 void cbIdle()
 {
-  if (toggle_animation_on_off)
-    update();
-  ConvertToDisplay();
+  if (!frames.update())
+  {
+    usleep(1000);
+    return;
+  }
+
+  displayFrame &frame = frames.readBuffer();
+  display_map = &frame.pixels[0];
+  for (size_t t = 0; t < display_dirty.size(); ++t) { display_dirty[t] |= frame.dirty[t]; }
+  if (frame.input_time != 0 && (display_input_time == 0 || frame.input_time < display_input_time))
+    display_input_time = frame.input_time;
+
   if (capture_mode)
     writeImage();
-  glutPostRedisplay(); 
+  glutPostRedisplay();
 }
 
 
@@ -378,6 +605,7 @@ void cbOnKeyboard( unsigned char key, int x, int y )
 
     case 'c':
       scaling_factor = 1.0;
+      applyScaleFactor();
       break;
 
     case ' ':
@@ -389,13 +617,15 @@ void cbOnKeyboard( unsigned char key, int x, int y )
       break;
 
     case ',' : case '<':
-      InitializeBrushes(BRUSH_SIZE-2);
-      cout << "Setting Brush Size To " << BRUSH_SIZE << endl;
+      requested_brush_size = requested_brush_size-2 < 3 ? 3 : requested_brush_size-2;
+      queueBrushEvent(BRUSH_RESIZE, requested_brush_size, 0);
+      cout << "Setting Brush Size To " << requested_brush_size << endl;
       break;
 
     case '.': case '>':
-      InitializeBrushes(BRUSH_SIZE+2);
-      cout << "Setting Brush Size To " << BRUSH_SIZE << endl;
+      requested_brush_size += 2;
+      queueBrushEvent(BRUSH_RESIZE, requested_brush_size, 0);
+      cout << "Setting Brush Size To " << requested_brush_size << endl;
       break;
 
     case 'o':
@@ -418,6 +648,14 @@ void cbOnKeyboard( unsigned char key, int x, int y )
       cout << "Paint Negative Divergence Mode" << endl;
       break;
 
+    case 'f':
+      frozen_flow = !frozen_flow;
+      if (frozen_flow)
+        cout << "Flow Frozen, Only Color Moves" << endl;
+      else
+        cout << "Flow Released" << endl;
+      break;
+
     case 'w':
       capture_mode = !capture_mode;
       if (capture_mode)
@@ -428,6 +666,11 @@ void cbOnKeyboard( unsigned char key, int x, int y )
 
     case 'q':
       cout << "Exiting Program" << endl;
+      stopSimulation();
+      if (!trace_path.empty() && writeTrace(trace_path.c_str()) == 0)
+        cout << "Wrote trace " << trace_path << endl;
+      if (perf_file != NULL && perf_file != stdout)
+        fclose(perf_file);
       exit(0);
 
     default:
@@ -440,17 +683,13 @@ void cbMouseDown( int button, int state, int x, int y )
 {
   if( button != GLUT_LEFT_BUTTON ) { return; }
   if( state != GLUT_DOWN ) { return; }
-  xmouse_prev = x;
-  ymouse_prev = y;
-  DabSomePaint( x, y );
+  queueBrushEvent( BRUSH_DOWN, x, y );
 }
 
 
 void cbMouseMove( int x, int y )
 {
-  xmouse_prev = x;
-  ymouse_prev = y;
-  DabSomePaint( x, y ); 
+  queueBrushEvent( BRUSH_MOVE, x, y );
 }
 
 
@@ -471,6 +710,7 @@ void PrintUsage()
   cout << "+/-      increase/decrease brightness of display\n";
   cout << ",/.      increase/decrease brush size\n";
   cout << "c        clears changes to brightness\n";
+  cout << "f        freezes the flow: only color moves until the next density, divergence or obstruction paint\n";
   cout << "w        starts capture mode. file path can be set with -output_path flag\n";
   cout << "spacebar paused the simulation. pressing it again un-pauses the simulation\n";
   cout << "q        exits the program\n";
@@ -488,87 +728,188 @@ struct point {
 };
 
 
-void set_texture() {
-
-  glBindTexture(GL_TEXTURE_2D,1);
+// The texture is allocated once and then refreshed through a ring of pixel
+// buffer objects: each frame the CPU writes the dirty tiles of display_map
+// into one PBO while glTexSubImage2D sources the tiles of the one filled on
+// the previous frame, so neither side waits for the other.
+#define UPLOAD_BUFFERS 3
+GLuint display_texture = 0;
+GLuint upload_pbo[UPLOAD_BUFFERS];
+vector<unsigned char> upload_dirty[UPLOAD_BUFFERS];
+long long upload_input_time[UPLOAD_BUFFERS];
+long long drawn_input_time = 0; // brush event shown by the current draw
+int upload_index = 0;
+
+void init_texture() {
+  const GLsizeiptr size = (GLsizeiptr) iwidth*iheight*3;
+
+  glGenTextures(1, &display_texture);
+  glBindTexture(GL_TEXTURE_2D,display_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT,1);
   glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,iwidth,iheight,0,GL_RGB,
                GL_UNSIGNED_BYTE,display_map);
   glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
   glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
   glTexEnvf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_MODULATE);
-}
 
-void drawStuff() {
-  int i;
-  struct point tile0[4]={{0.0,0.0,0.0},{0.5,0.0,0.0},{0.5,0.5,0.0},{0.0,0.5,0.0}};
-  struct point tile1[4]={{0.0,0.0,0.1},{0.75,0.0,0.1},{0.75,0.75,0.1},{0.0,0.75,0.1}};
-  struct point tile2[4]={{-0.25,0.0,-0.1},{0.25,0.0,-0.1},{0.25,0.5,-0.1},{-0.25,0.5,-0.1}};
-  struct point tile3[4]={{0.0,0.0,0.5},{0.75,0.0,0.5},{0.75,0.75,0.5},{0.0,0.75,0.5}};
-  struct point tile4[4]={{0.5,0.0,0.6},{1.0,0.0,0.6},{1.0,1.0,0.6},{0.5,1.0,0.6}};
-  struct point tile5[4]={{0.5,0.0,-0.2},{1.0,0.0,-0.2},{1.0,1.0,-0.2},{0.5,1.0,-0.2}};
-  struct point tile6[4]={{0.2,0.0,-0.3},{0.95,0.0,-0.3},{0.95,0.75,-0.3},{0.2,0.75,-0.3}};
-  struct point tile7[4]={{0.0,0.0,-0.4},{0.5,0.0,-0.4},{0.5,0.5,-0.4},{0.0,0.5,-0.4}};
-  struct point tile8[4]={{0.1,0.0,-0.41},{0.6,0.0,-0.41},{0.6,0.5,-0.41},{0.1,0.5,-0.41}};
-  float mytexcoords[4][2] = {{0.0,0.0},{1.0,0.0},{1.0,1.0},{0.0,1.0}};
-
-  set_texture();
-  glClearColor(0.0,0.0,0.0,0.0);
-  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-
-  glUseProgram((GLuint) shader_program);		// THIS IS IT!
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D,1);
-  glEnable(GL_TEXTURE_2D);
-  glBegin(GL_QUADS);
-  glNormal3f(0.0,0.0,1.0);
-
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile8[i].x,tile8[i].y,tile8[i].z);
+  glGenBuffers(UPLOAD_BUFFERS, upload_pbo);
+  for (int i = 0; i < UPLOAD_BUFFERS; ++i) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbo[i]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
   }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile7[i].x,tile7[i].y,tile7[i].z);
+// Calls fn(x, y, width, height) for every run of horizontally adjacent
+// dirty tiles, in pixels.
+template <typename Fn>
+void for_each_dirty_span(const vector<unsigned char>& dirty, Fn fn) {
+  const int tile = fluid->getTileSize();
+  const int tiles_x = fluid->getTilesX();
+  const int tiles_y = fluid->getTilesY();
+  if (dirty.empty()) { return; }
+
+  for (int ty = 0; ty < tiles_y; ++ty) {
+    int tx = 0;
+    while (tx < tiles_x) {
+      if (!dirty[tx + tiles_x*ty]) { ++tx; continue; }
+      const int start = tx;
+      while (tx < tiles_x && dirty[tx + tiles_x*ty]) { ++tx; }
+
+      const int x0 = start*tile, y0 = ty*tile;
+      const int x1 = tx*tile < iwidth ? tx*tile : iwidth;
+      const int y1 = y0 + tile < iheight ? y0 + tile : iheight;
+      fn(x0, y0, x1 - x0, y1 - y0);
+    }
   }
+}
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile6[i].x,tile6[i].y,tile6[i].z);
+void set_texture() {
+  CFD_TRACE_SCOPE("set_texture");
+  const GLsizeiptr size = (GLsizeiptr) iwidth*iheight*3;
+  const int fill_index = upload_index;
+  const int draw_index = (upload_index + UPLOAD_BUFFERS - 1) % UPLOAD_BUFFERS;
+
+  glBindTexture(GL_TEXTURE_2D,display_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH,iwidth);
+
+  // start the transfer of last frame's dirty tiles into the texture
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbo[draw_index]);
+  for_each_dirty_span(upload_dirty[draw_index], [](int x, int y, int w, int h) {
+    glTexSubImage2D(GL_TEXTURE_2D,0,x,y,w,h,GL_RGB,GL_UNSIGNED_BYTE,
+                    (const GLvoid*) ((size_t) (x + iwidth*y)*3));
+  });
+  upload_dirty[draw_index].clear();
+  drawn_input_time = upload_input_time[draw_index];
+  upload_input_time[draw_index] = 0;
+
+  // fill the next buffer with the tiles that changed since the last fill.
+  // invalidating lets the driver hand back fresh storage instead of waiting
+  // for a pending transfer from this buffer
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbo[fill_index]);
+  // when nothing changed there is nothing to fill, and mapping would
+  // orphan the buffer for no reason
+  const bool any_dirty = find(display_dirty.begin(), display_dirty.end(), 1) != display_dirty.end();
+  unsigned char *pixels = NULL;
+  if (any_dirty)
+    pixels = (unsigned char*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (pixels != NULL) {
+    for_each_dirty_span(display_dirty, [pixels](int x, int y, int w, int h) {
+      for (int j = y; j < y + h; ++j) {
+        memcpy(pixels + (x + iwidth*j)*3, display_map + (x + iwidth*j)*3, (size_t) w*3);
+      }
+    });
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    upload_dirty[fill_index].swap(display_dirty);
+    display_dirty.assign(upload_dirty[fill_index].size(), 0);
+    upload_input_time[fill_index] = display_input_time;
+    display_input_time = 0;
   }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile5[i].x,tile5[i].y,tile5[i].z);
-  }
+  upload_index = (upload_index + 1) % UPLOAD_BUFFERS;
+}
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile2[i].x,tile2[i].y,tile2[i].z);
-  }
+// Tiles are drawn from a vertex array object holding one unit quad plus a
+// per-instance buffer of tile placements, so a frame is a single instanced
+// draw call no matter how many tiles the layout has.
+#define TILE_TRANSFORM_ATTRIBUTE 1
+GLuint tile_vao = 0;
+GLuint quad_vbo = 0;
+GLuint tile_vbo = 0;
+vector<tileInstance> tiles;
+
+void init_geometry() {
+  // x, y, z, s, t for a unit quad drawn as a triangle fan
+  const float quad[4][5] = {
+    {0.0f, 0.0f, 0.0f, 0.0f, 0.0f},
+    {1.0f, 0.0f, 0.0f, 1.0f, 0.0f},
+    {1.0f, 1.0f, 0.0f, 1.0f, 1.0f},
+    {0.0f, 1.0f, 0.0f, 0.0f, 1.0f},
+  };
+
+  glGenVertexArrays(1, &tile_vao);
+  glBindVertexArray(tile_vao);
+
+  glGenBuffers(1, &quad_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 5*sizeof(float), (const GLvoid*) 0);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glTexCoordPointer(2, GL_FLOAT, 5*sizeof(float), (const GLvoid*) (3*sizeof(float)));
+
+  glGenBuffers(1, &tile_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, tile_vbo);
+  glBufferData(GL_ARRAY_BUFFER, tiles.size()*sizeof(tileInstance), &tiles[0], GL_STATIC_DRAW);
+  glEnableVertexAttribArray(TILE_TRANSFORM_ATTRIBUTE);
+  glVertexAttribPointer(TILE_TRANSFORM_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(tileInstance), (const GLvoid*) 0);
+  glVertexAttribDivisor(TILE_TRANSFORM_ATTRIBUTE, 1);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile0[i].x,tile0[i].y,tile0[i].z);
+// Input-to-photon latency: from the oldest brush event in a frame until
+// the draw showing it has finished. reported every couple of seconds
+void reportInputLatency(long long nanoseconds) {
+  static long long count = 0, total = 0, worst = 0;
+  static long long last_report = 0;
+
+  ++count;
+  total += nanoseconds;
+  if (nanoseconds > worst) { worst = nanoseconds; }
+
+  const long long now = nowNanoseconds();
+  if (now - last_report > 2000000000LL) {
+    printf("Input latency: mean %.1f ms, max %.1f ms over %lld frames\n",
+           total / (double) count * 1e-6, worst * 1e-6, count);
+    count = total = worst = 0;
+    last_report = now;
   }
+}
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile1[i].x,tile1[i].y,tile1[i].z);
-  }
+void drawStuff() {
+  CFD_TRACE_SCOPE("drawStuff");
+  set_texture();
+  glClearColor(0.0,0.0,0.0,0.0);
+  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile3[i].x,tile3[i].y,tile3[i].z);
-  }
+  glNormal3f(0.0,0.0,1.0);
+  glBindVertexArray(tile_vao);
+  glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, (GLsizei) tiles.size());
+  glBindVertexArray(0);
+  glFlush();
 
-  for(i=0;i<4;i++) {
-    glTexCoord2fv(mytexcoords[i]);
-    glVertex3f(tile4[i].x,tile4[i].y,tile4[i].z);
+  if (drawn_input_time != 0)
+  {
+    glFinish();
+    reportInputLatency(nowNanoseconds() - drawn_input_time);
+    drawn_input_time = 0;
   }
-
-  glEnd();
-  glFlush();
 }
 
 void setupViewVolume()
@@ -628,6 +969,7 @@ unsigned int setShaders()
   p = glCreateProgram();
   glAttachShader(p,f);
   glAttachShader(p,v);
+  glBindAttribLocation(p, TILE_TRANSFORM_ATTRIBUTE, "tile_transform");
   glLinkProgram(p);
   return(p);
 }
@@ -688,26 +1030,57 @@ int main(int argc, char** argv)
   int oploops = clf.find("-oploops", 1, "Number of orthogonal projection loops.");
 
   output_path = clf.find("-output_path", "output_images/", "Output path for writing image sequence");
-
-#ifdef __linux__
-  setNbCores(4);
-#endif
-
-//  string imagename = clf.find("-image", "dali1.jpeg", "Image to drive color");
+  string stream_name = clf.find("-stream", "", "Publish frames to this POSIX shared-memory name");
+  int stream_slots = clf.find("-stream_slots", 4, "Number of frames in the shared-memory ring");
+  string tile_file = clf.find("-tiles", "", "Tile layout file, one \"x y z size\" per line");
+  float gamma = clf.find("-gamma", 1.0f, "Display gamma");
+  fused_display = clf.find("-fused_display", 1, "Convert to display bytes inside the solver step") != 0;
+  trace_path = clf.find("-trace", "", "Write a Chrome trace of the run to this file on exit (needs CFD_TRACE)");
+  string perf_path = clf.find("-perf", "", "Write per frame hardware counters of the solver phases to this CSV file, - for stdout (needs CFD_PERF)");
+  simulation_rate = clf.find("-sim_rate", 24.0f, "Solver steps per second (0 runs as fast as possible)");
+  int threads = clf.find("-threads", 0, "Solver threads (0 uses CFD_THREADS or the OpenMP default)");
+  string bind = clf.find("-bind", "", "Pin solver threads: none, close or spread (default CFD_BIND or none)");
+  bool autotune_on = clf.find("-autotune", 0, "Pick kernels, tile size and thread count by timing a few steps (cached)") != 0;
+  string tuning_file = clf.find("-tuning_file", "cfd_tuning.txt", "Where -autotune keeps its results");
+  int tune_steps = clf.find("-tune_steps", 3, "Steps timed per -autotune candidate");
+  frozen_flow = clf.find("-frozen", 0, "Start with the flow frozen, only moving color (toggle with f)") != 0;
+  frame_every = clf.find("-frame_every", 1, "Show, publish and capture every this many steps, resampling color only for those");
+  bool skip_solids = clf.find("-skip_solids", 0, "Leave painted obstructions out of the pressure solve") != 0;
+  bool with_density = clf.find("-density", 0, "Keep and advect density (only gravity reads it, and gravity is 0)") != 0;
+  bool advect_velocity = clf.find("-advect_velocity", 1, "Carry velocity along the flow (0 leaves it to the pressure solve)") != 0;
+
+  string imagename = clf.find("-image", "", "Image or printf style image sequence to drive color");
+  int image_first = clf.find("-image_first", 1, "First frame of the image sequence");
+  int image_last = clf.find("-image_last", 1, "Last frame of the image sequence");
+  image_rate = clf.find("-image_rate", 0, "Inject an image frame every this many steps (0 injects once)");
+  image_gain = clf.find("-image_gain", 1.0f, "Strength of the injected image");
+  int image_cache = clf.find("-image_cache", 16, "Number of decoded frames kept in memory");
+  int image_prefetch = clf.find("-image_prefetch", 4, "Number of frames decoded ahead");
 
   clf.usage("-h");
   clf.printFinds();
   PrintUsage();
   cout << "\n\nPROGRAM OUTPUT:\n";
 
+  setTraceThreadName("display");
+  setTraceEnabled(!trace_path.empty());
+
+  if (makeThreadConfig(threads, bind, solver_threads) != 0)
+    exit(-1);
+
+  if (!perf_path.empty())
+  {
+    perf_file = perf_path == "-" ? stdout : fopen(perf_path.c_str(), "w");
+    if (perf_file == NULL)
+      cerr << "Warning: cannot write " << perf_path << ", hardware counters disabled" << endl;
+    setPerfEnabled(perf_file != NULL);
+  }
+
   // initialize a few variables
   scaling_factor = 1.0;
   toggle_animation_on_off = true;
   capture_mode = true;
 
-//  // if reading the image fails we need to allocate space for color_source
-//  if (readOIIOImage(imagename.c_str()) != 0)
-//    color_source = new float[iwidth*iheight*3]();
   iwidth = 128;
   iheight = 128;
 
@@ -721,29 +1094,95 @@ int main(int argc, char** argv)
 
   divergance_source = new float[iwidth*iheight*3]();
 
-  display_map = new unsigned char[iwidth*iheight*3];
+  if (!imagename.empty())
+  {
+    image_source = new imageSource(iwidth, iheight, image_cache, image_prefetch);
+    if (image_source->open(imagename, image_first, image_last) != 0)
+    {
+      handleError((const char *) "reading the color source image failed", 0);
+      delete image_source;
+      image_source = NULL;
+    }
+  }
+
+  if (tile_file.empty())
+    defaultTileLayout(tiles);
+  else if (loadTileLayout(tile_file.c_str(), tiles) != 0 || tiles.empty())
+  {
+    handleError((const char *) "reading the tile layout failed, using the default tiles", 0);
+    defaultTileLayout(tiles);
+  }
+
+  cfdTuning tuning;
+  if (autotune_on)
+  {
+    tuning = findTuning(tuning_file, iwidth, iheight, nloops, oploops, solver_threads, tune_steps, stdout);
+    solver_threads.threads = tuning.threads;
+  }
+
+  // initialize fluid. the fields are first touched by a team placed the way
+  // the solver thread's will be, after that this thread goes back to display
+  applyThreadConfig(solver_threads);
+  printThreadPlacement(stdout);
+  unsigned fields = cfd::FIELD_VELOCITY | cfd::FIELD_COLOR | (with_density ? cfd::FIELD_DENSITY : 0);
+  unsigned transported = fields & ~(advect_velocity ? 0u : (unsigned) cfd::FIELD_VELOCITY);
+  fluid = new cfd(iwidth, iheight, 1.0, (float)(1.0/24.0), nloops, oploops, cfdBuffers(), fields, transported);
+  if (autotune_on)
+    applyTuning(*fluid, tuning);
+  if (frame_every < 1)
+    frame_every = 1;
+  if (frame_every > 1)
+    fluid->setDeferredColor(true);
+  fluid->setSkipSolids(skip_solids);
+  restoreThreadAffinity();
+  if (gamma != 1.0f)
+  {
+    display_lut = new unsigned char[DISPLAY_LUT_SIZE];
+    buildDisplayLUT(display_lut, gamma);
+  }
+
+  // display frames shared with the solver thread
+  const int ntiles = fluid->getTilesX() * fluid->getTilesY();
+  for (int s = 0; s < 3; ++s)
+  {
+    frames.buffer(s).pixels.assign(iwidth*iheight*3, 0);
+    frames.buffer(s).dirty.assign(ntiles, 1);
+    frames.buffer(s).input_time = 0;
+    stale_tiles[s].assign(ntiles, 1);
+  }
+  last_published_dirty.assign(ntiles, 1);
+  display_dirty.assign(ntiles, 1);
 
-  // initialize fluid
-  fluid = new cfd(iwidth, iheight, 1.0, (float)(1.0/24.0), nloops, oploops);
+  applyScaleFactor();
   fluid->setColorSourceField(color_source);
   update();
-  ConvertToDisplay();
+  ConvertToDisplay(true);
+  frames.update();
+  display_map = &frames.readBuffer().pixels[0];
+
+  if (!stream_name.empty())
+  {
+    if (frame_stream.open(stream_name.c_str(), iwidth, iheight, 3, stream_slots) != 0)
+      handleError((const char *) "opening the shared-memory frame stream failed", 0);
+    else
+      cout << "Streaming frames to shared memory /" << stream_name << endl;
+  }
 
   InitializeBrushes(BRUSH_SIZE);
 
   paint_mode = PAINT_SOURCE;
 
-  DabSomePaint(64, 64);
+  DabSomePaint(64, 64, paint_mode);
 
   paint_mode = PAINT_DIVERGENCE_NEGATIVE;
-  DabSomePaint(60, 60);
-  DabSomePaint(30, 30);
-  DabSomePaint(70, 70);
-  DabSomePaint(100, 100);
-  DabSomePaint(64, 64);
-  DabSomePaint(64, 64);
-  DabSomePaint(64, 64);
-  DabSomePaint(64, 64);
+  DabSomePaint(60, 60, paint_mode);
+  DabSomePaint(30, 30, paint_mode);
+  DabSomePaint(70, 70, paint_mode);
+  DabSomePaint(100, 100, paint_mode);
+  DabSomePaint(64, 64, paint_mode);
+  DabSomePaint(64, 64, paint_mode);
+  DabSomePaint(64, 64, paint_mode);
+  DabSomePaint(64, 64, paint_mode);
 
   // GLUT routines
   glutInit(&argc, argv);
@@ -760,20 +1199,27 @@ int main(int argc, char** argv)
   glEnable (GL_BLEND);
   glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  set_texture();
+  init_texture();
   setupViewVolume();
   lights();
   material();
   shader_program = setShaders();
+  glUseProgram((GLuint) shader_program);
   set_uniform_parameters(shader_program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D,display_texture);
+  glEnable(GL_TEXTURE_2D);
+  init_geometry();
+
+  startSimulation();
 
   glutDisplayFunc(drawStuff);
   glutIdleFunc(&cbIdle);
   glutKeyboardFunc(cbOnKeyboard);
 
   cout << glGetString(GL_VERSION) << endl;
-//  glutMouseFunc(&cbMouseDown);
-//  glutMotionFunc(&cbMouseMove);
+  glutMouseFunc(&cbMouseDown);
+  glutMotionFunc(&cbMouseMove);
 
   glutMainLoop();
   return 1;
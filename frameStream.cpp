@@ -0,0 +1,243 @@
+//
+// Shared-memory frame stream for handing finished color frames to other
+// local processes without touching the disk.
+//
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frameStream.h"
+
+
+static size_t alignTo(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+
+//----------------------------------------------------
+//
+//  Writer
+//
+//----------------------------------------------------
+
+
+frameStreamWriter::frameStreamWriter()
+{
+  shm_name[0] = '\0';
+  map_size = 0;
+  header = 0;
+  base = 0;
+  frame_number = 0;
+}
+
+
+frameStreamWriter::~frameStreamWriter()
+{
+  close();
+}
+
+
+int frameStreamWriter::open(const char* name, int width, int height, int channels, int nslots)
+{
+  close();
+
+  if (nslots < 2) { nslots = 2; }
+  if (nslots > FRAME_STREAM_MAX_SLOTS) { nslots = FRAME_STREAM_MAX_SLOTS; }
+
+  snprintf(shm_name, sizeof(shm_name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+  const size_t frame_bytes = (size_t) width * height * channels * sizeof(float);
+  const size_t slot_offset = alignTo(sizeof(frameStreamHeader), 64);
+  const size_t slot_stride = alignTo(frame_bytes, 64);
+  map_size = slot_offset + slot_stride * nslots;
+
+  // start from a fresh object so stale readers never see a resized layout
+  shm_unlink(shm_name);
+  int fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) { perror("frameStreamWriter: shm_open"); return -1; }
+
+  if (ftruncate(fd, (off_t) map_size) != 0)
+  {
+    perror("frameStreamWriter: ftruncate");
+    ::close(fd);
+    shm_unlink(shm_name);
+    return -1;
+  }
+
+  void* mapping = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    perror("frameStreamWriter: mmap");
+    shm_unlink(shm_name);
+    return -1;
+  }
+
+  base = (unsigned char*) mapping;
+  header = new (mapping) frameStreamHeader;
+  header->width = (uint32_t) width;
+  header->height = (uint32_t) height;
+  header->channels = (uint32_t) channels;
+  header->slots = (uint32_t) nslots;
+  header->frame_bytes = frame_bytes;
+  header->slot_offset = slot_offset;
+  for (int s = 0; s < FRAME_STREAM_MAX_SLOTS; ++s)
+    header->slot_sequence[s].store(0, std::memory_order_relaxed);
+  header->latest.store(0, std::memory_order_relaxed);
+  header->version = FRAME_STREAM_VERSION;
+
+  // readers key off the magic, so publish it last
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = FRAME_STREAM_MAGIC;
+
+  frame_number = 0;
+  return 0;
+}
+
+
+void frameStreamWriter::close()
+{
+  if (header != 0)
+  {
+    munmap(base, map_size);
+    shm_unlink(shm_name);
+  }
+  header = 0;
+  base = 0;
+  map_size = 0;
+}
+
+
+void frameStreamWriter::publish(const float* frame)
+{
+  if (header == 0) { return; }
+
+  const uint64_t frame_bytes = header->frame_bytes;
+  const size_t slot_stride = alignTo(frame_bytes, 64);
+  const int slot = (int) (frame_number % header->slots);
+
+  // odd sequence marks the slot as being written
+  header->slot_sequence[slot].store(2*frame_number + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  memcpy(base + header->slot_offset + slot_stride * slot, frame, frame_bytes);
+
+  header->slot_sequence[slot].store(2*frame_number + 2, std::memory_order_release);
+  header->latest.store(frame_number + 1, std::memory_order_release);
+  ++frame_number;
+}
+
+
+//----------------------------------------------------
+//
+//  Reader
+//
+//----------------------------------------------------
+
+
+frameStreamReader::frameStreamReader()
+{
+  map_size = 0;
+  header = 0;
+  base = 0;
+}
+
+
+frameStreamReader::~frameStreamReader()
+{
+  close();
+}
+
+
+int frameStreamReader::open(const char* name)
+{
+  close();
+
+  char shm_name[256];
+  snprintf(shm_name, sizeof(shm_name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+  int fd = shm_open(shm_name, O_RDONLY, 0);
+  if (fd < 0) { perror("frameStreamReader: shm_open"); return -1; }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(frameStreamHeader))
+  {
+    fprintf(stderr, "frameStreamReader: %s is not a frame stream\n", shm_name);
+    ::close(fd);
+    return -1;
+  }
+
+  void* mapping = mmap(0, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) { perror("frameStreamReader: mmap"); return -1; }
+
+  frameStreamHeader* h = (frameStreamHeader*) mapping;
+  if (h->magic != FRAME_STREAM_MAGIC || h->version != FRAME_STREAM_VERSION)
+  {
+    fprintf(stderr, "frameStreamReader: %s has an unknown layout\n", shm_name);
+    munmap(mapping, (size_t) st.st_size);
+    return -1;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  // the slots have to fit in what was mapped; a truncated or mismatched
+  // object would otherwise be read past its end
+  const size_t size = (size_t) st.st_size;
+  const uint64_t pixel_bytes = (uint64_t) h->width * h->height * h->channels * sizeof(float);
+  const bool fits = h->slots >= 1 && h->slots <= FRAME_STREAM_MAX_SLOTS &&
+                    h->frame_bytes == pixel_bytes && h->frame_bytes <= size &&
+                    h->slot_offset >= sizeof(frameStreamHeader) && h->slot_offset <= size &&
+                    alignTo(h->frame_bytes, 64) * h->slots <= size - h->slot_offset;
+  if (!fits)
+  {
+    fprintf(stderr, "frameStreamReader: %s does not match its header\n", shm_name);
+    munmap(mapping, size);
+    return -1;
+  }
+
+  map_size = size;
+  header = h;
+  base = (const unsigned char*) mapping;
+  return 0;
+}
+
+
+void frameStreamReader::close()
+{
+  if (header != 0)
+    munmap((void*) base, map_size);
+  header = 0;
+  base = 0;
+  map_size = 0;
+}
+
+
+const float* frameStreamReader::latest(uint64_t* sequence) const
+{
+  if (header == 0) { return 0; }
+
+  const uint64_t newest = header->latest.load(std::memory_order_acquire);
+  if (newest == 0) { return 0; }
+
+  const uint64_t frame = newest - 1;
+  const int slot = (int) (frame % header->slots);
+  if (header->slot_sequence[slot].load(std::memory_order_acquire) != 2*frame + 2)
+    return 0; // already being recycled, the caller just tries again
+
+  *sequence = frame;
+  return (const float*) (base + header->slot_offset + alignTo(header->frame_bytes, 64) * slot);
+}
+
+
+bool frameStreamReader::isValid(uint64_t sequence) const
+{
+  if (header == 0) { return false; }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const int slot = (int) (sequence % header->slots);
+  return header->slot_sequence[slot].load(std::memory_order_relaxed) == 2*sequence + 2;
+}
@@ -0,0 +1,88 @@
+//
+// Shared-memory frame stream for handing finished color frames to other
+// local processes without touching the disk.
+//
+
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+#define FRAME_STREAM_MAGIC     0x46535452u // 'FSTR'
+#define FRAME_STREAM_VERSION   1u
+#define FRAME_STREAM_MAX_SLOTS 8
+
+// Layout of the start of the shared-memory object. The frame slots follow
+// the header, each frame_bytes long and 64 byte aligned.
+//
+// Every slot carries its own sequence word used as a seqlock: it is odd
+// while the writer fills the slot and 2*frame+2 once frame number 'frame'
+// is complete. 'latest' holds the number of the newest complete frame
+// plus one, so zero means nothing has been published yet.
+struct frameStreamHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width, height, channels;
+  uint32_t slots;
+  uint64_t frame_bytes;
+  uint64_t slot_offset;
+  std::atomic<uint64_t> latest;
+  std::atomic<uint64_t> slot_sequence[FRAME_STREAM_MAX_SLOTS];
+};
+
+
+class frameStreamWriter
+{
+  public:
+    frameStreamWriter();
+    ~frameStreamWriter();
+
+    // create (or replace) the shared-memory object /name. returns 0 on success
+    int open(const char* name, int width, int height, int channels, int nslots);
+    void close();
+
+    // copy one width*height*channels float frame into the next slot
+    void publish(const float* frame);
+
+    bool isOpen() const { return header != 0; }
+
+  private:
+    char               shm_name[256];
+    size_t             map_size;
+    frameStreamHeader  *header;
+    unsigned char      *base;
+    uint64_t           frame_number;
+};
+
+
+class frameStreamReader
+{
+  public:
+    frameStreamReader();
+    ~frameStreamReader();
+
+    // map an existing stream read-only. returns 0 on success
+    int open(const char* name);
+    void close();
+
+    // Pointer straight into the shared mapping for the newest complete
+    // frame, or 0 if none has been published. The frame is not copied, so
+    // the caller must check isValid() with the returned sequence after it
+    // has finished reading to know the writer did not recycle the slot.
+    const float* latest(uint64_t* sequence) const;
+    bool isValid(uint64_t sequence) const;
+
+    int width()    const { return header ? (int) header->width : 0; }
+    int height()   const { return header ? (int) header->height : 0; }
+    int channels() const { return header ? (int) header->channels : 0; }
+
+  private:
+    size_t             map_size;
+    frameStreamHeader  *header;
+    const unsigned char *base;
+};
+
+#endif //FRAMESTREAM_H
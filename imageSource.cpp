@@ -0,0 +1,246 @@
+//
+// Image and image-sequence color sources. Frames are decoded and resampled
+// to the simulation grid on a background thread so that feeding them to
+// cfd::setColorSourceField never waits on file I/O.
+//
+#include <cstdio>
+#include <iostream>
+#include <OpenImageIO/imageio.h>
+#include "imageSource.h"
+#include "phaseTimer.h"
+
+OIIO_NAMESPACE_USING
+
+
+imageSource::imageSource(int nx, int ny, int cacheFrames, int prefetch)
+{
+  Nx = nx;
+  Ny = ny;
+  cacheSize = cacheFrames < 1 ? 1 : cacheFrames;
+  prefetchCount = prefetch < 1 ? 1 : prefetch;
+  if (prefetchCount > cacheSize) { prefetchCount = cacheSize; }
+  firstFrame = 0;
+  lastFrame = 0;
+  current = 0;
+  running = false;
+}
+
+
+imageSource::~imageSource()
+{
+  close();
+}
+
+
+int imageSource::open(const std::string& path, int first, int last)
+{
+  close();
+
+  pattern = path;
+  if (pattern.find('%') == std::string::npos)
+  {
+    first = 0;
+    last = 0;
+  }
+  if (last < first) { last = first; }
+  firstFrame = first;
+  lastFrame = last;
+  current = first;
+
+  // decode the first frame right away so a bad path is reported at startup
+  std::vector<float> resampled;
+  if (!decode(first, resampled))
+    return -1;
+  cache[first].swap(resampled);
+
+  running = true;
+  worker = std::thread(&imageSource::decodeLoop, this);
+  return 0;
+}
+
+
+void imageSource::close()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    running = false;
+  }
+  wakeup.notify_all();
+  if (worker.joinable())
+    worker.join();
+  cache.clear();
+  failed.clear();
+}
+
+
+bool imageSource::addCurrentFrame(float* color, float gain)
+{
+  std::unique_lock<std::mutex> guard(lock, std::try_to_lock);
+  if (!guard.owns_lock())
+    return false; // the decoder is touching the cache, try again next step
+
+  const int length = lastFrame - firstFrame + 1;
+  std::map<int, std::vector<float> >::iterator entry = cache.find(current);
+  if (entry == cache.end())
+  {
+    // skip frames that could not be read instead of stalling on them forever
+    if (failed.count(current))
+      current = firstFrame + (current - firstFrame + 1) % length;
+    guard.unlock();
+    wakeup.notify_one();
+    return false;
+  }
+
+  const float* frame = &entry->second[0];
+  for (int i = 0; i < Nx*Ny*3; ++i) { color[i] += frame[i] * gain; }
+
+  current = firstFrame + (current - firstFrame + 1) % length;
+  guard.unlock();
+  wakeup.notify_one();
+  return true;
+}
+
+
+void imageSource::decodeLoop()
+{
+  setTraceThreadName("image decode");
+  std::unique_lock<std::mutex> guard(lock);
+  while (running)
+  {
+    const int frame = nextWanted();
+    if (frame < 0)
+    {
+      wakeup.wait(guard);
+      continue;
+    }
+
+    // decode without holding the lock so the simulation is never blocked
+    guard.unlock();
+    std::vector<float> resampled;
+    const bool ok = decode(frame, resampled);
+    guard.lock();
+
+    if (ok)
+    {
+      cache[frame].swap(resampled);
+      evict();
+    }
+    else
+      failed[frame] = true;
+  }
+}
+
+
+int imageSource::distanceAhead(int frame) const
+{
+  const int length = lastFrame - firstFrame + 1;
+  return ((frame - current) % length + length) % length;
+}
+
+
+int imageSource::nextWanted()
+{
+  const int length = lastFrame - firstFrame + 1;
+  const int window = prefetchCount < length ? prefetchCount : length;
+  for (int k = 0; k < window; ++k)
+  {
+    const int frame = firstFrame + (current - firstFrame + k) % length;
+    if (cache.count(frame) == 0 && failed.count(frame) == 0)
+      return frame;
+  }
+  return -1;
+}
+
+
+void imageSource::evict()
+{
+  // drop the frames that will be needed last
+  while ((int) cache.size() > cacheSize)
+  {
+    std::map<int, std::vector<float> >::iterator farthest = cache.begin();
+    for (std::map<int, std::vector<float> >::iterator it = cache.begin(); it != cache.end(); ++it)
+    {
+      if (distanceAhead(it->first) > distanceAhead(farthest->first))
+        farthest = it;
+    }
+    cache.erase(farthest);
+  }
+}
+
+
+std::string imageSource::frameName(int frame) const
+{
+  if (firstFrame == lastFrame && pattern.find('%') == std::string::npos)
+    return pattern;
+
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer), pattern.c_str(), frame);
+  return std::string(buffer);
+}
+
+
+bool imageSource::decode(int frame, std::vector<float>& resampled) const
+{
+  CFD_TRACE_SCOPE("image decode");
+  const std::string fname = frameName(frame);
+  ImageInput *in = ImageInput::create(fname);
+  if (! in)
+  {
+    std::cerr << "imageSource: cannot read " << fname << std::endl;
+    return false;
+  }
+  ImageSpec spec;
+  if (! in->open(fname, spec))
+  {
+    std::cerr << "imageSource: cannot open " << fname << std::endl;
+    delete in;
+    return false;
+  }
+  const int width = spec.width;
+  const int height = spec.height;
+  const int channels = spec.nchannels;
+  std::vector<float> pixels((size_t) width*height*channels);
+  in->read_image(TypeDesc::FLOAT, &pixels[0]);
+  in->close();
+  delete in;
+
+  // Resample to the grid with bilinear filtering, flipping vertically since
+  // images are stored top row first and the grid starts at the bottom.
+  // grey images feed all three channels, alpha is ignored.
+  resampled.assign((size_t) Nx*Ny*3, 0.0f);
+  const float sx = (float) width / Nx;
+  const float sy = (float) height / Ny;
+  for (int j = 0; j < Ny; ++j)
+  {
+    float y = (j + 0.5f) * sy - 0.5f;
+    if (y < 0.0f) { y = 0.0f; }
+    int y0 = (int) y;
+    if (y0 > height-1) { y0 = height-1; }
+    const int y1 = y0 + 1 < height ? y0 + 1 : y0;
+    const float ay = y - y0;
+    const int row0 = height - 1 - y0;
+    const int row1 = height - 1 - y1;
+
+    for (int i = 0; i < Nx; ++i)
+    {
+      float x = (i + 0.5f) * sx - 0.5f;
+      if (x < 0.0f) { x = 0.0f; }
+      int x0 = (int) x;
+      if (x0 > width-1) { x0 = width-1; }
+      const int x1 = x0 + 1 < width ? x0 + 1 : x0;
+      const float ax = x - x0;
+
+      for (int c = 0; c < 3; ++c)
+      {
+        const int cc = channels < 3 ? 0 : c;
+        const float p00 = pixels[((size_t) x0 + (size_t) width*row0)*channels + cc];
+        const float p10 = pixels[((size_t) x1 + (size_t) width*row0)*channels + cc];
+        const float p01 = pixels[((size_t) x0 + (size_t) width*row1)*channels + cc];
+        const float p11 = pixels[((size_t) x1 + (size_t) width*row1)*channels + cc];
+        resampled[(i + (size_t) Nx*j)*3 + c] = (1-ax)*(1-ay)*p00 + ax*(1-ay)*p10 +
+                                               (1-ax)*ay*p01     + ax*ay*p11;
+      }
+    }
+  }
+  return true;
+}
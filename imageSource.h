@@ -0,0 +1,64 @@
+//
+// Image and image-sequence color sources. Frames are decoded and resampled
+// to the simulation grid on a background thread so that feeding them to
+// cfd::setColorSourceField never waits on file I/O.
+//
+
+#ifndef IMAGESOURCE_H
+#define IMAGESOURCE_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class imageSource
+{
+  public:
+    // nx, ny:      simulation grid the frames are resampled to
+    // cacheFrames: number of decoded frames kept in memory
+    // prefetch:    number of frames decoded ahead of the current one
+    imageSource(int nx, int ny, int cacheFrames, int prefetch);
+    ~imageSource();
+
+    // A single image, or a printf style pattern (e.g. "plate.%04d.jpg")
+    // that is played from first to last and then loops. returns 0 on success
+    int open(const std::string& path, int first, int last);
+    void close();
+
+    // Add gain * the current frame into an Nx*Ny*3 color field and move on
+    // to the next frame. Never blocks on decoding: returns false (and stays
+    // on the same frame) if it is not decoded yet.
+    bool addCurrentFrame(float* color, float gain);
+
+    bool isOpen()       const { return running; }
+    bool isSequence()   const { return firstFrame != lastFrame; }
+    int currentFrame()  const { return current; }
+
+  private:
+    int                 Nx, Ny;
+    int                 cacheSize;
+    int                 prefetchCount;
+    std::string         pattern;
+    int                 firstFrame, lastFrame;
+    int                 current;
+    bool                running;
+
+    std::thread         worker;
+    std::mutex          lock;
+    std::condition_variable wakeup;
+    std::map<int, std::vector<float> > cache;
+    std::map<int, bool> failed;
+
+    // private methods
+    void decodeLoop();
+    int nextWanted();
+    void evict();
+    int distanceAhead(int frame) const;
+    std::string frameName(int frame) const;
+    bool decode(int frame, std::vector<float>& resampled) const;
+};
+
+#endif //IMAGESOURCE_H
@@ -0,0 +1,244 @@
+//
+// Hardware performance counters (Linux perf_event_open) around solver
+// phases: cycles, instructions, cache misses and branch misses.
+//
+#include <cstring>
+#include "perfCounters.h"
+
+#if defined(CFD_PERF) && defined(__linux__)
+
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PERF_MAX_PHASES 64
+
+std::atomic<bool> perfEnabled(false);
+
+struct perfPhase
+{
+  const char *name;
+  perfTotals totals;
+};
+
+struct perfThreadState
+{
+  bool      opened;
+  bool      available;
+  int       fd[PERF_COUNTER_COUNT];
+  int       leader;
+  int       nphases;
+  perfPhase phases[PERF_MAX_PHASES];
+};
+
+static perfThreadState& threadPerfState()
+{
+  static thread_local perfThreadState state;
+  return state;
+}
+
+// notes about missing counters are printed once, not once per thread
+static std::atomic<int> perf_warned(0);
+static const char* perf_counter_names[PERF_COUNTER_COUNT] = { "cycles", "instructions", "cache-misses", "branch-misses" };
+
+static int openCounter(uint64_t config, int group)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group < 0 ? 1 : 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void openThreadCounters(perfThreadState& state)
+{
+  const uint64_t configs[PERF_COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+  state.opened = true;
+  state.available = false;
+  state.leader = -1;
+  for (int c = 0; c < PERF_COUNTER_COUNT; ++c) { state.fd[c] = -1; }
+
+  // all counters in one group so they are scheduled together. a counter
+  // the host does not have is left out rather than failing the group
+  for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+  {
+    state.fd[c] = openCounter(configs[c], state.leader);
+    if (state.fd[c] < 0)
+    {
+      const int error = errno;
+      if ((perf_warned.fetch_or(1 << c) & (1 << c)) == 0)
+        fprintf(stderr, "Note: hardware counter %s unavailable (%s)\n", perf_counter_names[c], strerror(error));
+      continue;
+    }
+    if (state.leader < 0) { state.leader = state.fd[c]; }
+  }
+
+  if (state.leader < 0)
+  {
+    if ((perf_warned.fetch_or(1 << PERF_COUNTER_COUNT) & (1 << PERF_COUNTER_COUNT)) == 0)
+      fprintf(stderr, "Note: no hardware performance counters available, perf reports disabled\n");
+    return;
+  }
+  ioctl(state.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(state.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  state.available = true;
+}
+
+static perfThreadState* readyThreadState()
+{
+  perfThreadState& state = threadPerfState();
+  if (!state.opened) { openThreadCounters(state); }
+  return state.available ? &state : 0;
+}
+
+static void readCounters(const perfThreadState& state, double* values)
+{
+  for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+  {
+    values[c] = 0.0;
+    if (state.fd[c] < 0) { continue; }
+
+    // value, time enabled, time running. scale up if the PMU multiplexed
+    uint64_t data[3];
+    if (read(state.fd[c], data, sizeof(data)) != (ssize_t) sizeof(data)) { continue; }
+    values[c] = (double) data[0];
+    if (data[2] > 0 && data[2] < data[1])
+      values[c] *= (double) data[1] / (double) data[2];
+  }
+}
+
+static perfPhase* findPhase(perfThreadState& state, const char* name)
+{
+  for (int p = 0; p < state.nphases; ++p)
+  {
+    if (state.phases[p].name == name || strcmp(state.phases[p].name, name) == 0)
+      return &state.phases[p];
+  }
+  if (state.nphases == PERF_MAX_PHASES) { return 0; }
+
+  perfPhase& phase = state.phases[state.nphases++];
+  phase.name = name;
+  memset(&phase.totals, 0, sizeof(phase.totals));
+  for (int c = 0; c < PERF_COUNTER_COUNT; ++c) { phase.totals.valid[c] = state.fd[c] >= 0; }
+  return &phase;
+}
+
+
+perfScope::perfScope(const char* phase_name)
+{
+  name = 0;
+  if (!perfEnabled.load(std::memory_order_relaxed)) { return; }
+
+  perfThreadState* state = readyThreadState();
+  if (state == 0) { return; }
+  name = phase_name;
+  readCounters(*state, start);
+}
+
+
+perfScope::~perfScope()
+{
+  if (name == 0) { return; }
+
+  perfThreadState& state = threadPerfState();
+  double end[PERF_COUNTER_COUNT];
+  readCounters(state, end);
+
+  perfPhase* phase = findPhase(state, name);
+  if (phase == 0) { return; }
+  phase->totals.calls++;
+  for (int c = 0; c < PERF_COUNTER_COUNT; ++c) { phase->totals.value[c] += end[c] - start[c]; }
+}
+
+
+void setPerfEnabled(bool enabled)
+{
+  perfEnabled.store(enabled);
+}
+
+
+bool perfCountersAvailable()
+{
+  return readyThreadState() != 0;
+}
+
+
+perfTotals perfPhaseTotals(const char* name)
+{
+  perfTotals totals;
+  memset(&totals, 0, sizeof(totals));
+  perfThreadState* state = readyThreadState();
+  if (state == 0) { return totals; }
+  for (int p = 0; p < state->nphases; ++p)
+  {
+    if (strcmp(state->phases[p].name, name) == 0)
+      return state->phases[p].totals;
+  }
+  return totals;
+}
+
+
+void perfReset()
+{
+  threadPerfState().nphases = 0;
+}
+
+
+void perfFrameReport(FILE* fp, long frame)
+{
+  perfThreadState* state = readyThreadState();
+  if (state == 0) { return; }
+
+  if (frame == 0)
+    fprintf(fp, "frame,phase,calls,cycles,instructions,ipc,cache_misses,branch_misses\n");
+  for (int p = 0; p < state->nphases; ++p)
+  {
+    const perfTotals& t = state->phases[p].totals;
+    if (t.calls == 0) { continue; }
+    fprintf(fp, "%ld,%s,%lld", frame, state->phases[p].name, t.calls);
+    for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+    {
+      if (c == PERF_CACHE_MISSES)
+      {
+        if (t.valid[PERF_CYCLES] && t.valid[PERF_INSTRUCTIONS] && t.value[PERF_CYCLES] > 0.0)
+          fprintf(fp, ",%.3f", t.value[PERF_INSTRUCTIONS] / t.value[PERF_CYCLES]);
+        else
+          fprintf(fp, ",");
+      }
+      if (t.valid[c])
+        fprintf(fp, ",%.0f", t.value[c]);
+      else
+        fprintf(fp, ",");
+    }
+    fprintf(fp, "\n");
+  }
+  state->nphases = 0;
+}
+
+#else
+
+#ifdef CFD_PERF
+// no counters off Linux; the scopes still have to link
+std::atomic<bool> perfEnabled(false);
+perfScope::perfScope(const char*) : name(0) {}
+perfScope::~perfScope() {}
+#endif
+
+void setPerfEnabled(bool) {}
+bool perfCountersAvailable() { return false; }
+perfTotals perfPhaseTotals(const char*) { perfTotals totals; memset(&totals, 0, sizeof(totals)); return totals; }
+void perfReset() {}
+void perfFrameReport(FILE*, long) {}
+
+#endif
@@ -0,0 +1,68 @@
+//
+// Hardware performance counters (Linux perf_event_open) around solver
+// phases: cycles, instructions, cache misses and branch misses.
+//
+// Compiled in only when CFD_PERF is defined, and then only counting while
+// enabled with setPerfEnabled(). Counters follow the calling thread only;
+// each thread opens its own set the first time it enters a phase. If the
+// kernel refuses (no PMU in a VM or container, perf_event_paranoid) a note
+// is printed once and the scopes do nothing.
+//
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdio>
+
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_COUNTER_COUNT };
+
+struct perfTotals
+{
+  long long calls;
+  double    value[PERF_COUNTER_COUNT]; // scaled for multiplexing
+  bool      valid[PERF_COUNTER_COUNT]; // false if the host lacks the event
+};
+
+#ifdef CFD_PERF
+
+#include <atomic>
+
+extern std::atomic<bool> perfEnabled;
+
+// Adds the counts between construction and destruction to the phase
+// 'name' of the calling thread. names are compared by content.
+class perfScope
+{
+  public:
+    perfScope(const char* phase_name);
+    ~perfScope();
+
+  private:
+    const char *name;
+    double     start[PERF_COUNTER_COUNT];
+};
+
+#define CFD_PERF_CONCAT2(a, b) a##b
+#define CFD_PERF_CONCAT(a, b) CFD_PERF_CONCAT2(a, b)
+#define CFD_PERF_SCOPE(name) perfScope CFD_PERF_CONCAT(perf_scope_, __LINE__)(name)
+
+#else
+
+#define CFD_PERF_SCOPE(name)
+
+#endif //CFD_PERF
+
+// Always available. Without CFD_PERF or without counter access they report
+// nothing: perfCountersAvailable() is false and the totals have no calls.
+void setPerfEnabled(bool enabled);
+bool perfCountersAvailable();
+
+// totals of one phase of the calling thread since the last reset
+perfTotals perfPhaseTotals(const char* name);
+void perfReset();
+
+// One CSV line per phase of the calling thread that ran since the last
+// report, then resets. Writes the header when frame is 0.
+void perfFrameReport(FILE* fp, long frame);
+
+#endif //PERFCOUNTERS_H
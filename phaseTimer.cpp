@@ -0,0 +1,156 @@
+//
+// Scoped phase timers that record into per-thread buffers and can be
+// written out as Chrome trace-event JSON (chrome://tracing, Perfetto).
+//
+#include <cstdio>
+#include "phaseTimer.h"
+
+#ifdef CFD_TRACE
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TRACE_EVENTS_PER_THREAD (1 << 18)
+
+struct traceEvent
+{
+  const char *name;
+  long long  start, end; // nanoseconds
+};
+
+// Filled only by its own thread. count is published with release order so
+// writeTrace() can read the events before it from any thread; when the
+// buffer is full further events are dropped rather than overwriting.
+struct traceBuffer
+{
+  int                tid;
+  std::string        name;
+  std::atomic<int>   count;
+  std::atomic<long long> dropped;
+  traceEvent         events[TRACE_EVENTS_PER_THREAD];
+};
+
+std::atomic<bool> traceEnabled(false);
+
+// registration is the only locked operation, once per thread
+static std::mutex trace_registry_lock;
+static std::vector<traceBuffer*> trace_registry;
+
+static traceBuffer* threadTraceBuffer()
+{
+  static thread_local traceBuffer* buffer = 0;
+  if (buffer == 0)
+  {
+    buffer = new traceBuffer;
+    buffer->count = 0;
+    buffer->dropped = 0;
+    std::lock_guard<std::mutex> guard(trace_registry_lock);
+    buffer->tid = (int) trace_registry.size() + 1;
+    trace_registry.push_back(buffer);
+  }
+  return buffer;
+}
+
+
+long long phaseTimer::traceNow()
+{
+  return (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void phaseTimer::traceRecord(const char* name, long long start, long long end)
+{
+  traceBuffer* buffer = threadTraceBuffer();
+  const int n = buffer->count.load(std::memory_order_relaxed);
+  if (n >= TRACE_EVENTS_PER_THREAD)
+  {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer->events[n].name = name;
+  buffer->events[n].start = start;
+  buffer->events[n].end = end;
+  buffer->count.store(n + 1, std::memory_order_release);
+}
+
+
+void setTraceEnabled(bool enabled)
+{
+  traceEnabled.store(enabled);
+}
+
+
+void setTraceThreadName(const char* name)
+{
+  threadTraceBuffer()->name = name;
+}
+
+
+int writeTrace(const char* filename)
+{
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "Error: cannot write trace %s\n", filename);
+    return -1;
+  }
+
+  std::vector<traceBuffer*> buffers;
+  {
+    std::lock_guard<std::mutex> guard(trace_registry_lock);
+    buffers = trace_registry;
+  }
+
+  long long origin = -1;
+  for (size_t b = 0; b < buffers.size(); ++b)
+  {
+    if (buffers[b]->count.load(std::memory_order_acquire) > 0 &&
+        (origin < 0 || buffers[b]->events[0].start < origin))
+      origin = buffers[b]->events[0].start;
+  }
+
+  fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  const char *separator = "";
+  for (size_t b = 0; b < buffers.size(); ++b)
+  {
+    const traceBuffer* buffer = buffers[b];
+    if (!buffer->name.empty())
+    {
+      fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+              separator, buffer->tid, buffer->name.c_str());
+      separator = ",\n";
+    }
+
+    // timestamps in microseconds, as the format expects
+    const int n = buffer->count.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+    {
+      const traceEvent& e = buffer->events[i];
+      fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+              separator, e.name, buffer->tid, (e.start - origin) * 1e-3, (e.end - e.start) * 1e-3);
+      separator = ",\n";
+    }
+    if (buffer->dropped.load() > 0)
+      fprintf(stderr, "Warning: trace buffer of thread %d was full, %lld events dropped\n",
+              buffer->tid, buffer->dropped.load());
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+  return 0;
+}
+
+#else
+
+void setTraceEnabled(bool) {}
+void setTraceThreadName(const char*) {}
+
+int writeTrace(const char* filename)
+{
+  fprintf(stderr, "Error: cannot write %s, tracing was not compiled in (build with CFD_TRACE)\n", filename);
+  return -1;
+}
+
+#endif //CFD_TRACE
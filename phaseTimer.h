@@ -0,0 +1,52 @@
+//
+// Scoped phase timers that record into per-thread buffers and can be
+// written out as Chrome trace-event JSON (chrome://tracing, Perfetto).
+//
+// Timers are only compiled in when CFD_TRACE is defined, and then only
+// record while tracing is switched on with setTraceEnabled().
+//
+
+#ifndef PHASETIMER_H
+#define PHASETIMER_H
+
+#ifdef CFD_TRACE
+
+#include <atomic>
+
+extern std::atomic<bool> traceEnabled;
+
+// Records one complete event for the lifetime of the object. The name must
+// be a string literal (only the pointer is kept).
+class phaseTimer
+{
+  public:
+    phaseTimer(const char* phase_name)
+      : name(traceEnabled.load(std::memory_order_relaxed) ? phase_name : 0),
+        start(name ? traceNow() : 0) {}
+    ~phaseTimer() { if (name) { traceRecord(name, start, traceNow()); } }
+
+    static long long traceNow();
+    static void traceRecord(const char* name, long long start, long long end);
+
+  private:
+    const char *name;
+    long long  start;
+};
+
+#define CFD_TRACE_CONCAT2(a, b) a##b
+#define CFD_TRACE_CONCAT(a, b) CFD_TRACE_CONCAT2(a, b)
+#define CFD_TRACE_SCOPE(name) phaseTimer CFD_TRACE_CONCAT(phase_timer_, __LINE__)(name)
+
+#else
+
+#define CFD_TRACE_SCOPE(name)
+
+#endif //CFD_TRACE
+
+// These are always available so callers need no #ifdefs; without CFD_TRACE
+// they do nothing and writeTrace() reports that tracing was compiled out.
+void setTraceEnabled(bool enabled);
+void setTraceThreadName(const char* name);
+int writeTrace(const char* filename);
+
+#endif //PHASETIMER_H
@@ -1,9 +1,15 @@
 varying vec3 ec_vnormal, ec_vposition;
 
+// Per-tile placement: xyz offset and uniform size. Drawn without the
+// attribute it defaults to (0,0,0,1) and vertices pass through unchanged.
+attribute vec4 tile_transform;
+
 void main()
 {
+    vec4 vertex = vec4(gl_Vertex.xy*tile_transform.w + tile_transform.xy,
+                       gl_Vertex.z + tile_transform.z, gl_Vertex.w);
     ec_vnormal = gl_NormalMatrix*gl_Normal;
-    ec_vposition = gl_ModelViewMatrix*gl_Vertex;
-    gl_Position = gl_ProjectionMatrix*gl_ModelViewMatrix*gl_Vertex;
+    ec_vposition = vec3(gl_ModelViewMatrix*vertex);
+    gl_Position = gl_ProjectionMatrix*gl_ModelViewMatrix*vertex;
     gl_TexCoord[0] = gl_MultiTexCoord0;
-}
\ No newline at end of file
+}
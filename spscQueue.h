@@ -0,0 +1,51 @@
+//
+// Lock-free bounded single-producer/single-consumer queue.
+//
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Capacity must be a power of two; one slot is kept free to tell a full
+// queue from an empty one.
+template <typename T, size_t Capacity>
+class spscQueue
+{
+  public:
+    spscQueue() : head(0), tail(0) {}
+
+    // producer side. returns false if the queue is full
+    bool push(const T& item)
+    {
+      const size_t t = tail.load(std::memory_order_relaxed);
+      const size_t next = (t + 1) & (Capacity - 1);
+      if (next == head.load(std::memory_order_acquire))
+        return false;
+      items[t] = item;
+      tail.store(next, std::memory_order_release);
+      return true;
+    }
+
+    // consumer side. returns false if the queue is empty
+    bool pop(T& item)
+    {
+      const size_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire))
+        return false;
+      item = items[h];
+      head.store((h + 1) & (Capacity - 1), std::memory_order_release);
+      return true;
+    }
+
+  private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "spscQueue capacity must be a power of two");
+
+    T                    items[Capacity];
+    // producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif //SPSCQUEUE_H
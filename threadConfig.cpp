@@ -0,0 +1,350 @@
+//
+// Thread count and placement for the OpenMP teams that run cfd.
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "threadConfig.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+#ifdef __linux__
+  #include <dirent.h>
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+
+namespace
+{
+
+struct numaTopology
+{
+  int              nodes;
+  std::vector<int> nodeOfCpu; // indexed by cpu number
+  std::vector<int> allowed;   // cpus the process could run on at start up
+#ifdef __linux__
+  cpu_set_t        startMask;
+#endif
+};
+
+
+#ifdef __linux__
+// "0-3,8,10-11" style cpu lists from /sys
+std::vector<int> readCpuList(const char* path)
+{
+  std::vector<int> cpus;
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL)
+    return cpus;
+
+  int first, last;
+  char separator;
+  while (fscanf(fp, "%d", &first) == 1)
+  {
+    last = first;
+    if (fscanf(fp, "%c", &separator) == 1 && separator == '-')
+    {
+      if (fscanf(fp, "%d", &last) != 1)
+        break;
+      if (fscanf(fp, "%c", &separator) != 1)
+        separator = '\n';
+    }
+    for (int cpu = first; cpu <= last; ++cpu) { cpus.push_back(cpu); }
+    if (separator != ',')
+      break;
+  }
+  fclose(fp);
+  return cpus;
+}
+#endif
+
+
+numaTopology readTopology()
+{
+  numaTopology topo;
+  topo.nodes = 1;
+
+#ifdef __linux__
+  CPU_ZERO(&topo.startMask);
+  sched_getaffinity(0, sizeof(topo.startMask), &topo.startMask);
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+  {
+    if (CPU_ISSET(cpu, &topo.startMask))
+      topo.allowed.push_back(cpu);
+  }
+  topo.nodeOfCpu.assign(topo.allowed.empty() ? 1 : topo.allowed.back() + 1, 0);
+
+  DIR* dir = opendir("/sys/devices/system/node");
+  if (dir != NULL)
+  {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+      int node;
+      char rest;
+      if (sscanf(entry->d_name, "node%d%c", &node, &rest) != 1)
+        continue;
+
+      char path[512];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+      const std::vector<int> cpus = readCpuList(path);
+      for (size_t k = 0; k < cpus.size(); ++k)
+      {
+        if (cpus[k] < (int) topo.nodeOfCpu.size())
+          topo.nodeOfCpu[cpus[k]] = node;
+      }
+      topo.nodes = std::max(topo.nodes, node + 1);
+    }
+    closedir(dir);
+  }
+#endif
+
+  return topo;
+}
+
+
+const numaTopology& topology()
+{
+  static const numaTopology topo = readTopology();
+  return topo;
+}
+
+
+// the cpu for each thread index, wrapping around when there are more threads
+std::vector<int> placementOrder(const numaTopology& topo, threadBinding binding)
+{
+  std::vector<std::vector<int> > byNode(topo.nodes);
+  for (size_t k = 0; k < topo.allowed.size(); ++k)
+    byNode[numaNodeOfCpu(topo.allowed[k])].push_back(topo.allowed[k]);
+
+  std::vector<int> order;
+  if (binding == BIND_CLOSE)
+  {
+    for (int n = 0; n < topo.nodes; ++n) { order.insert(order.end(), byNode[n].begin(), byNode[n].end()); }
+  }
+  else if (binding == BIND_SPREAD)
+  {
+    for (size_t k = 0; order.size() < topo.allowed.size(); ++k)
+    {
+      for (int n = 0; n < topo.nodes; ++n)
+      {
+        if (k < byNode[n].size())
+          order.push_back(byNode[n][k]);
+      }
+    }
+  }
+  return order;
+}
+
+
+int threadIndex()
+{
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+
+int teamSize()
+{
+#ifdef _OPENMP
+  return omp_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+
+int currentCpu()
+{
+#ifdef __linux__
+  return sched_getcpu();
+#else
+  return 0;
+#endif
+}
+
+} // namespace
+
+
+int makeThreadConfig(int threads, const std::string& bind, threadConfig& config)
+{
+  config.threads = threads;
+  if (config.threads <= 0 && getenv("CFD_THREADS") != NULL)
+    config.threads = atoi(getenv("CFD_THREADS"));
+  if (config.threads < 0)
+    config.threads = 0;
+
+  std::string name = bind;
+  if (name.empty() && getenv("CFD_BIND") != NULL)
+    name = getenv("CFD_BIND");
+
+  if (name.empty() || name == "none")
+    config.binding = BIND_NONE;
+  else if (name == "close")
+    config.binding = BIND_CLOSE;
+  else if (name == "spread")
+    config.binding = BIND_SPREAD;
+  else
+  {
+    fprintf(stderr, "Error: unknown thread binding %s, use none, close or spread\n", name.c_str());
+    config.binding = BIND_NONE;
+    return -1;
+  }
+  return 0;
+}
+
+
+void applyThreadConfig(const threadConfig& config)
+{
+  const numaTopology& topo = topology();
+
+#ifdef _OPENMP
+  if (config.threads > 0)
+    omp_set_num_threads(config.threads);
+#endif
+
+#ifdef __linux__
+  const std::vector<int> order = placementOrder(topo, config.binding);
+  if (order.empty())
+    return;
+
+#pragma omp parallel
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(order[threadIndex() % order.size()], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#else
+  (void) topo;
+#endif
+}
+
+
+void restoreThreadAffinity()
+{
+#ifdef __linux__
+  const numaTopology& topo = topology();
+  pthread_setaffinity_np(pthread_self(), sizeof(topo.startMask), &topo.startMask);
+#endif
+}
+
+
+const char* threadBindingName(threadBinding binding)
+{
+  switch (binding)
+  {
+    case BIND_CLOSE:  return "close";
+    case BIND_SPREAD: return "spread";
+    default:          return "none";
+  }
+}
+
+
+int numaNodeCount()
+{
+  return topology().nodes;
+}
+
+
+int numaNodeOfCpu(int cpu)
+{
+  const numaTopology& topo = topology();
+  if (cpu < 0 || cpu >= (int) topo.nodeOfCpu.size())
+    return 0;
+  return topo.nodeOfCpu[cpu];
+}
+
+
+void printThreadPlacement(FILE* fp)
+{
+  std::vector<int> cpus;
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+#ifdef __linux__
+#pragma omp single
+#endif
+    cpus.assign(teamSize(), 0);
+    cpus[threadIndex()] = currentCpu();
+  }
+
+  fprintf(fp, "%d threads on %d NUMA node%s\n", (int) cpus.size(), numaNodeCount(),
+          numaNodeCount() == 1 ? "" : "s");
+  for (int n = 0; n < numaNodeCount(); ++n)
+  {
+    std::string list;
+    int count = 0;
+    for (size_t t = 0; t < cpus.size(); ++t)
+    {
+      if (numaNodeOfCpu(cpus[t]) != n)
+        continue;
+      char entry[32];
+      snprintf(entry, sizeof(entry), "%s%d@%d", count ? " " : "", (int) t, cpus[t]);
+      list += entry;
+      ++count;
+    }
+    fprintf(fp, "  node %d: %d thread%s%s%s\n", n, count, count == 1 ? "" : "s",
+            count ? " (thread@cpu) " : "", list.c_str());
+  }
+}
+
+
+int measureNodeBandwidth(std::vector<double>& gbps, size_t floats)
+{
+  const int reps = 10;
+  std::vector<double> threadGbps;
+  std::vector<int> threadNode;
+  if (floats < 1)
+    floats = 1;
+
+#ifdef __linux__
+#pragma omp parallel
+#endif
+  {
+#ifdef __linux__
+#pragma omp single
+#endif
+    {
+      threadGbps.assign(teamSize(), 0.0);
+      threadNode.assign(teamSize(), 0);
+    }
+
+    // first touch here, so the arrays sit on this thread's node
+    float *a = new float[floats], *b = new float[floats], *c = new float[floats];
+    for (size_t k = 0; k < floats; ++k) { a[k] = 0.0f; b[k] = 1.0f; c[k] = 2.0f; }
+
+#ifdef __linux__
+#pragma omp barrier
+#endif
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r)
+    {
+      for (size_t k = 0; k < floats; ++k) { a[k] = b[k] + 0.5f * c[k]; }
+
+      // rotate so that every pass depends on the one before
+      float* t = c; c = b; b = a; a = t;
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    threadGbps[threadIndex()] = 3.0 * sizeof(float) * floats * reps / elapsed * 1e-9;
+    threadNode[threadIndex()] = numaNodeOfCpu(currentCpu());
+    volatile float keep = b[floats/2];
+    (void) keep;
+    delete [] a;
+    delete [] b;
+    delete [] c;
+  }
+
+  gbps.assign(numaNodeCount(), 0.0);
+  for (size_t t = 0; t < threadGbps.size(); ++t) { gbps[threadNode[t]] += threadGbps[t]; }
+  return numaNodeCount();
+}
@@ -0,0 +1,59 @@
+//
+// Thread count and placement for the OpenMP teams that run cfd, and the
+// NUMA layout of the machine they are placed on.
+//
+// OpenMP keeps one team per thread that opens parallel regions, so apply
+// the configuration on every thread that constructs or steps a cfd. With
+// binding, thread t of every team is pinned to the same cpu, which keeps
+// the pages a cfd first touched on construction local to the thread that
+// works on them later. Without binding OMP_PROC_BIND and OMP_PLACES still
+// apply. NUMA nodes are read from /sys; elsewhere there is one node and
+// pinning does nothing.
+//
+
+#ifndef THREADCONFIG_H
+#define THREADCONFIG_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum threadBinding
+{
+  BIND_NONE,   // leave placement to the OS (or OMP_PROC_BIND)
+  BIND_CLOSE,  // fill the cpus of one node before moving on to the next
+  BIND_SPREAD  // deal threads out over the nodes in turn
+};
+
+struct threadConfig
+{
+  int           threads; // 0 keeps the OpenMP default
+  threadBinding binding;
+};
+
+// From -threads / -bind style values. threads <= 0 and an empty bind fall
+// back to the CFD_THREADS and CFD_BIND environment variables. returns 0,
+// or -1 with a message for a binding other than none, close or spread
+int makeThreadConfig(int threads, const std::string& bind, threadConfig& config);
+
+// Sets the team size of the calling thread and pins the team's threads.
+// The calling thread is pinned too; restoreThreadAffinity() lets it run
+// anywhere again once it is done with parallel work.
+void applyThreadConfig(const threadConfig& config);
+void restoreThreadAffinity();
+
+const char* threadBindingName(threadBinding binding);
+
+int numaNodeCount();
+int numaNodeOfCpu(int cpu);
+
+// one line per NUMA node with the threads of the calling thread's team on it
+void printThreadPlacement(FILE* fp);
+
+// Triad (a = b + s*c) on every thread of the calling thread's team at once,
+// each over its own arrays of 'floats' floats first touched by itself. The
+// bandwidth of the threads on each node is summed into gbps[node] (GB/s,
+// three arrays counted per element). returns the number of nodes
+int measureNodeBandwidth(std::vector<double>& gbps, size_t floats);
+
+#endif //THREADCONFIG_H
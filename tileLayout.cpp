@@ -0,0 +1,52 @@
+//
+// Layout of the textured tiles the fluid texture is displayed on.
+//
+#include <cstdio>
+#include <cstring>
+#include "tileLayout.h"
+
+
+void defaultTileLayout(std::vector<tileInstance>& tiles)
+{
+  // back to front, as the blended tiles were drawn originally
+  const tileInstance layout[9] = {
+    { 0.1f,  0.0f, -0.41f, 0.5f  },
+    { 0.0f,  0.0f, -0.4f,  0.5f  },
+    { 0.2f,  0.0f, -0.3f,  0.75f },
+    { 0.5f,  0.0f, -0.2f,  0.5f  },
+    { -0.25f,0.0f, -0.1f,  0.5f  },
+    { 0.0f,  0.0f,  0.0f,  0.5f  },
+    { 0.0f,  0.0f,  0.1f,  0.75f },
+    { 0.0f,  0.0f,  0.5f,  0.75f },
+    { 0.5f,  0.0f,  0.6f,  0.5f  },
+  };
+  tiles.assign(layout, layout + 9);
+}
+
+
+int loadTileLayout(const char* filename, std::vector<tileInstance>& tiles)
+{
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) { return -1; }
+
+  tiles.clear();
+  char line[512];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    ++line_number;
+    const char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') { continue; }
+
+    tileInstance tile;
+    if (sscanf(p, "%f %f %f %f", &tile.x, &tile.y, &tile.z, &tile.size) != 4)
+    {
+      fprintf(stderr, "Error: %s:%d expected \"x y z size\"\n", filename, line_number);
+      fclose(fp);
+      return -1;
+    }
+    tiles.push_back(tile);
+  }
+  fclose(fp);
+  return 0;
+}
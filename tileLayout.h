@@ -0,0 +1,25 @@
+//
+// Layout of the textured tiles the fluid texture is displayed on.
+//
+
+#ifndef TILELAYOUT_H
+#define TILELAYOUT_H
+
+#include <vector>
+
+// A square tile of side 'size' whose lower left corner sits at (x, y, z),
+// facing +z. Tiles are drawn in the order they are listed.
+struct tileInstance
+{
+  float x, y, z;
+  float size;
+};
+
+// The nine overlapping tiles of the original display.
+void defaultTileLayout(std::vector<tileInstance>& tiles);
+
+// Reads one tile per line as "x y z size". Blank lines and lines starting
+// with '#' are skipped. returns 0 on success
+int loadTileLayout(const char* filename, std::vector<tileInstance>& tiles);
+
+#endif //TILELAYOUT_H
@@ -0,0 +1,56 @@
+//
+// Lock-free single-producer/single-consumer triple buffer. The producer
+// always has a buffer to write into, the consumer always has the newest
+// complete one to read, and neither ever waits for the other.
+//
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+template <typename T>
+class tripleBuffer
+{
+  public:
+    tripleBuffer() : middle(1), back(0), front(2) {}
+
+    // all three buffers, for sizing them before the threads start
+    T& buffer(int i)            { return buffers[i]; }
+
+    // producer side
+    T& writeBuffer()            { return buffers[back]; }
+    int writeIndex()      const { return back; }
+
+    // Hand the write buffer to the consumer and take the spare one back.
+    // Frames the consumer has not picked up yet are simply replaced.
+    void publish()
+    {
+      back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // true while the last published frame has not been picked up
+    bool hasUnread()      const { return (middle.load(std::memory_order_acquire) & FRESH) != 0; }
+
+    // consumer side. returns true and switches readBuffer() to the newest
+    // frame if one was published since the last call
+    bool update()
+    {
+      if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+        return false;
+      front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+      return true;
+    }
+    T& readBuffer()             { return buffers[front]; }
+    int readIndex()       const { return front; }
+
+  private:
+    enum { INDEX = 3, FRESH = 4 };
+
+    T                 buffers[3];
+    std::atomic<int>  middle; // index of the shared buffer, FRESH if unread
+    int               back;   // owned by the producer
+    int               front;  // owned by the consumer
+};
+
+#endif //TRIPLEBUFFER_H
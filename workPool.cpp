@@ -0,0 +1,122 @@
+//
+// A fixed set of worker threads with per-worker task queues and stealing.
+//
+#include "workPool.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+
+workPool::workPool(int nthreads)
+{
+  if (nthreads < 1) { nthreads = (int) std::thread::hardware_concurrency(); }
+  if (nthreads < 1) { nthreads = 1; }
+
+  current = 0;
+  remaining = 0;
+  stealing = true;
+  stolen = 0;
+  generation = 0;
+  stopping = false;
+  for (int w = 0; w < nthreads; ++w) { queues.push_back(new workerQueue); }
+  for (int w = 0; w < nthreads; ++w) { threads.push_back(std::thread(&workPool::workerLoop, this, w)); }
+}
+
+
+workPool::~workPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t w = 0; w < threads.size(); ++w) { threads[w].join(); }
+  for (size_t w = 0; w < queues.size(); ++w) { delete queues[w]; }
+}
+
+
+void workPool::run(int count, const int* owner, const std::function<void(int)>& task, bool steal)
+{
+  if (count < 1) { return; }
+
+  // set before any task is queued: a worker still draining the last batch
+  // may pick up a task of this one as soon as it is pushed
+  std::unique_lock<std::mutex> guard(lock);
+  current = &task;
+  stealing = steal;
+  remaining = count;
+
+  for (int k = 0; k < count; ++k)
+  {
+    workerQueue& queue = *queues[owner[k] % queues.size()];
+    std::lock_guard<std::mutex> queue_guard(queue.lock);
+    queue.tasks.push_back(k);
+  }
+
+  ++generation;
+  wake.notify_all();
+  while (remaining.load() > 0) { finished.wait(guard); }
+  current = 0;
+}
+
+
+bool workPool::takeTask(int worker, int* task)
+{
+  {
+    workerQueue& own = *queues[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.tasks.empty())
+    {
+      *task = own.tasks.back();
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+
+  const int n = stealing.load() ? (int) queues.size() : 0;
+  for (int k = 1; k < n; ++k)
+  {
+    workerQueue& victim = *queues[(worker + k) % n];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.tasks.empty())
+    {
+      *task = victim.tasks.front();
+      victim.tasks.pop_front();
+      stolen.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void workPool::workerLoop(int worker)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(1);
+#endif
+  long long seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      while (!stopping && generation == seen) { wake.wait(guard); }
+      if (stopping) { return; }
+      seen = generation;
+    }
+
+    // current was set before the task was queued, and stays valid until
+    // the last task of its batch is done
+    int task;
+    while (takeTask(worker, &task))
+    {
+      (*current)(task);
+      if (remaining.fetch_sub(1) == 1)
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        finished.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,61 @@
+//
+// A fixed set of worker threads that run batches of independent tasks.
+// Every task starts out queued on a chosen worker; a worker that runs out
+// of its own tasks steals from the other queues, so a badly guessed split
+// still finishes together.
+//
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class workPool
+{
+  public:
+    // nthreads < 1 uses one thread per core. OpenMP inside the tasks is
+    // limited to one thread, the pool is the parallelism.
+    explicit workPool(int nthreads);
+    ~workPool();
+
+    int size() const { return (int) threads.size(); }
+
+    // Runs task(k) for k = 0..count-1 and returns when all are done. Task k
+    // is queued on worker owner[k] % size(). Owners take their newest task
+    // first, thieves the oldest. With steal false every task runs on its
+    // owner, for work that has to happen on a given thread.
+    void run(int count, const int* owner, const std::function<void(int)>& task, bool steal = true);
+
+    // tasks that ran on another worker than queued, since construction
+    long long stolenTasks() const { return stolen.load(); }
+
+  private:
+    struct workerQueue
+    {
+      std::mutex      lock;
+      std::deque<int> tasks;
+    };
+
+    std::vector<std::thread>  threads;
+    std::vector<workerQueue*> queues;
+    std::mutex                lock;
+    std::condition_variable   wake, finished;
+    const std::function<void(int)> *current;
+    std::atomic<int>          remaining;
+    std::atomic<bool>         stealing; // set by run() before it queues
+    std::atomic<long long>    stolen;
+    long long                 generation;
+    bool                      stopping;
+
+    // private methods
+    void workerLoop(int worker);
+    bool takeTask(int worker, int* task);
+};
+
+#endif //WORKPOOL_H